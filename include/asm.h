@@ -0,0 +1,39 @@
+#ifndef ASM_H
+#define ASM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "../include/bus.h"
+
+#define ASM_ORIGIN 0x8000           // Where code goes before the first .org.
+#define ASM_MAX_MACROS 64
+#define ASM_MAX_PARAMS 8
+#define ASM_MAX_DEPTH 16            // Macros may expand other macros this deep.
+#define ASM_ERROR_SIZE 128
+
+typedef struct {
+    uint16_t start;                 // Address of the first byte emitted.
+    uint16_t end;                   // One past the last byte of the section holding the first byte.
+    size_t size;                    // Bytes emitted in all sections.
+    int error_line;                 // Line of the first error, 0 if the source assembled.
+    char error[ASM_ERROR_SIZE];
+} AsmResult;
+
+// Assembles 6502 source straight into the bus in two passes. The opcodes come from instructions[],
+// so the variant the core was built for decides which mnemonics and modes exist.
+//
+//   label:  lda #<value + 1     ; labels end in a colon, comments start with a semicolon
+//   name = expression           ; a constant, expressions have + - * / % & | ^ << >> ~ and
+//                               ; < and > for the low and high byte, * is the current address
+//   .org $C000                  ; numbers are decimal, $hex, %binary or 'c'
+//   .byte 1, "text", $FF
+//   .word label
+//   .macro name first, second   ; parameters are replaced where they appear as words,
+//   .endm                       ; \@ by a number unique to each expansion
+//
+// Operands that only need one byte use the zero page forms, unless they refer to a label defined
+// further down. Returns false and fills in error and error_line on the first error.
+extern bool asm_assemble(Bus* bus, const char* source, AsmResult* result);
+
+#endif // !ASM_H
@@ -0,0 +1,54 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "../include/bus.h"
+
+#define BLOCK_BASE 0xF100
+#define BLOCK_SECTOR_SIZE 512
+
+// Registers, relative to the page the device is mapped at.
+#define BLOCK_SECTOR_LOW 0x00   // First sector of the next transfer.
+#define BLOCK_SECTOR_HIGH 0x01
+#define BLOCK_DMA_LOW 0x02      // Ram address of the next transfer.
+#define BLOCK_DMA_HIGH 0x03
+#define BLOCK_COUNT 0x04        // Sectors in the next transfer.
+#define BLOCK_COMMAND 0x05      // Write BLOCK_READ or BLOCK_WRITE to transfer, read the status of the last one.
+#define BLOCK_SIZE_LOW 0x06     // Read only, sectors on the device.
+#define BLOCK_SIZE_HIGH 0x07
+
+#define BLOCK_READ 0x01         // Device to ram.
+#define BLOCK_WRITE 0x02        // Ram to device.
+
+#define BLOCK_STATUS_OK 0x00
+#define BLOCK_STATUS_ERROR 0x01 // Unknown command or sectors past the end of the device.
+
+// Replay source of the bytes a read transfer hands the cpu, apart from the console's.
+#define BLOCK_SOURCE_DATA 0x10
+
+// A disk backed by a host file mapped into memory. A command moves whole sectors between the file
+// and the bus in one go, then advances the sector and the ram address past them so the guest can
+// stream a file with one store per transfer.
+typedef struct {
+    BusDevice device;
+    Bus* bus;
+
+    uint8_t* data;
+    size_t size;
+
+    uint16_t sector;
+    uint16_t dma_address;
+    uint8_t count;
+    uint8_t status;
+} BlockDevice;
+
+// Maps the file and the device at the page holding base. The file is used whole, a trailing
+// partial sector is not reachable.
+extern bool block_open(BlockDevice* block, Bus* bus, uint16_t base, const char* path);
+
+// Writes the file back and unmaps the device.
+extern void block_close(BlockDevice* block);
+
+#endif // !BLOCK_H
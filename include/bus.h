@@ -4,16 +4,55 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-#define RAM_SIZE 0xFFFF
+#define RAM_SIZE 0x10000
+
+// Devices are mapped a 256 byte page at a time, accesses to the other pages go straight to ram.
+#define BUS_PAGE_SHIFT 8
+#define BUS_PAGES (RAM_SIZE >> BUS_PAGE_SHIFT)
+
+#define BUS_NO_EVENT UINT64_MAX
+
+typedef uint8_t (*BusRead)(void* device, uint16_t address);
+typedef void (*BusWrite)(void* device, uint16_t address, uint8_t data);
+typedef bool (*BusQuiet)(void* device, uint16_t address);
+typedef uint64_t (*BusNextEvent)(void* device, uint64_t cycle);
+
+// A memory mapped device, the handlers get the full address and the device they were mapped with.
+// quiet may be NULL, otherwise it tells which reads have no side effects, so a loop that polls
+// them can be skipped. next_event may be NULL, otherwise it returns the first cycle from cycle on
+// at which the device changes what those reads return by itself, or BUS_NO_EVENT.
+typedef struct {
+    BusRead read;
+    BusWrite write;
+    void* device;
+    BusQuiet quiet;
+    BusNextEvent next_event;
+} BusDevice;
 
 typedef struct {
     uint8_t* ram;
+    const BusDevice* pages[BUS_PAGES];
+
+    uint64_t read_count;
+    uint64_t write_count;
+    uint64_t mmio_count;
+    uint64_t effect_count;      // Device writes and the device reads that are not quiet.
 } Bus;
 
-extern void bus_init(Bus* bus);
+// Returns false when the ram cannot be allocated.
+extern bool bus_init(Bus* bus);
 
 extern void bus_free(Bus* bus);
 
+// Maps the device over count pages starting at the one holding address, NULL maps ram back in.
+extern void bus_map(Bus* bus, uint16_t address, uint16_t count, const BusDevice* device);
+
+// Maps ram back in wherever the device is mapped.
+extern void bus_unmap(Bus* bus, const BusDevice* device);
+
+// The earliest next event of the devices mapped on the bus, BUS_NO_EVENT if none has one.
+extern uint64_t bus_next_event(const Bus* bus, uint64_t cycle);
+
 extern void bus_write(Bus* bus, uint16_t address, uint8_t data);
 
 extern uint8_t bus_read(Bus* bus, uint16_t address);
@@ -0,0 +1,51 @@
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include "../include/bus.h"
+
+#define CONSOLE_BASE 0xF000
+#define CONSOLE_BUFFER_SIZE 0x1000
+
+// Registers, relative to the page the console is mapped at.
+#define CONSOLE_OUT 0x00        // Write a character to the output.
+#define CONSOLE_IN 0x01         // Read the next character of the input, 0 once it has ended.
+#define CONSOLE_STATUS 0x02     // Read CONSOLE_STATUS_READY and CONSOLE_STATUS_EOF.
+#define CONSOLE_FLUSH 0x03      // Write anything to flush the output.
+
+#define CONSOLE_STATUS_READY 0x01   // A character can be read without waiting.
+#define CONSOLE_STATUS_EOF 0x80     // The input has ended.
+
+// Replay sources of the values the console hands the cpu.
+#define CONSOLE_SOURCE_IN 0x00
+#define CONSOLE_SOURCE_STATUS 0x01
+
+// A character console on stdin and stdout. Output is collected and written in batches, when the
+// buffer fills, on a flush, before the guest waits for input and once per line on a terminal.
+typedef struct {
+    BusDevice device;
+    FILE* out;
+    int in;
+    bool line_buffered;
+
+    uint8_t output[CONSOLE_BUFFER_SIZE];
+    size_t output_length;
+    bool muted;                     // Output is dropped, set while a replay runs again what was printed.
+
+    uint8_t input[CONSOLE_BUFFER_SIZE];
+    size_t input_position;
+    size_t input_length;
+    bool eof;
+} Console;
+
+// Maps the console at the page holding base.
+extern void console_init(Console* console, Bus* bus, uint16_t base);
+
+extern void console_flush(Console* console);
+
+// Flushes the output and unmaps the console.
+extern void console_free(Console* console, Bus* bus);
+
+#endif // !CONSOLE_H
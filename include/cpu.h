@@ -2,34 +2,80 @@
 #define CPU_H
 
 #include <stdint.h>
+#include <stdatomic.h>
 #include "../include/bus.h"
 
+// The core is specialized for one cpu at compile time, e.g. -DCPU_VARIANT=CPU_65C02, so the
+// handlers and instructions[] never test the variant while running.
+#define CPU_NMOS 0      // MOS 6502
+#define CPU_65C02 1     // CMOS 65C02, without the Rockwell and WDC bit instructions
+#define CPU_2A03 2      // Ricoh 2A03, an NMOS 6502 without decimal mode
+
+#ifndef CPU_VARIANT
+#define CPU_VARIANT CPU_NMOS
+#endif
+
+// Interrupt inputs, packed in one word so the run loop tests them all with a single load.
+// The low bits are level triggered IRQ lines, one per device. NMI is edge triggered: the line
+// going active latches NMI_PENDING, which stays set until the NMI is taken.
+#define IRQ_LINES_MASK 0x3FFFFFFF
+#define NMI_LINE 0x40000000
+#define NMI_PENDING 0x80000000
+#define INTERRUPT_PENDING_MASK (IRQ_LINES_MASK | NMI_PENDING)
+
+typedef struct Replay Replay;
+
+// What the NMOS parts do on an undocumented opcode, kept per cpu. The 65C02 has none.
+typedef enum {
+    UNDOCUMENTED_EXECUTE,   // Run it like the hardware does, the default.
+    UNDOCUMENTED_LOG,       // Run it and report the first time each opcode is seen.
+    UNDOCUMENTED_TRAP,      // Halt the cpu with the pc on the opcode.
+} UndocumentedPolicy;
+
 typedef struct {
     uint8_t a, x, y;
     uint8_t status;
     uint16_t pc;
     uint8_t opcode;
     uint8_t sp;
-    uint32_t clock_count;
+    uint64_t clock_count;
     uint8_t cycles;
 
     uint16_t fetched_address;
     uint8_t fetched_data;
 
     Bus* bus;
+
+    // Written by devices from any thread, only read by the cpu at instruction boundaries.
+    _Atomic uint32_t interrupt_lines;
+
+    // Plain counters bumped on the hot path and copied out by stats_publish().
+    uint64_t instruction_count;
+    uint64_t interrupt_count;
+    uint64_t illegal_count;
+
+    // Set by JAM and by trapped undocumented opcodes, the run loop stops on it. Cleared by reset.
+    bool halted;
+
+    // Logs or plays back the interrupt lines when set, see replay.h.
+    Replay* replay;
+
+    UndocumentedPolicy undocumented;
+    uint32_t undocumented_seen[8];  // One bit per opcode already logged.
 } Cpu;
 
 typedef enum {
     C = 0x01,	// Carry Bit
     Z = 0x02,	// Zero
     I = 0x04,	// Disable Interrupts
-    D = 0x08,	// Decimal Mode (unused in this implementation)
+    D = 0x08,	// Decimal Mode (ignored by the 2A03)
     B = 0x10,	// Break
     U = 0x20,	// Unused
     V = 0x40,	// Overflow
     N = 0x80,	// Negative
 } CpuFlags;
 
+
 typedef uint8_t(*AddressMode)(void);
 typedef uint8_t(*Opcode)(void);
 
@@ -40,7 +86,8 @@ typedef struct {
     uint8_t cycles;
 } Instruction;
 
-extern void cpu_init();
+// Creates a cpu and selects it. Returns false and leaves the selection alone when out of memory.
+extern bool cpu_init();
 
 extern void cpu_free();
 
@@ -54,12 +101,22 @@ extern void cpu_write(uint16_t address, uint8_t data);
 
 extern bool cpu_clock();
 
+// Sets the policy of the selected cpu, the others keep theirs.
+extern void cpu_set_undocumented_policy(UndocumentedPolicy policy);
+
+// Runs the handler of the undocumented cpu->opcode the way the selected cpu's policy says, for
+// the interpreter and for code recomp6502 generated.
+extern uint8_t cpu_run_undocumented();
+
 extern void set_flag(CpuFlags flag, bool set);
 
 extern uint8_t get_flag(CpuFlags flag);
 
 extern Cpu* get_cpu();
 
+// Makes the cpu the one cpu_clock and the handlers work on for the calling thread.
+extern void cpu_select(Cpu* target);
+
 extern uint8_t fetch();
  
 extern uint8_t ILL();
@@ -83,10 +140,29 @@ extern uint8_t JMP();
 extern uint8_t BCC(); extern uint8_t BCS(); extern uint8_t BEQ(); extern uint8_t BMI();
 extern uint8_t BNE(); extern uint8_t BPL(); extern uint8_t BVS(); extern uint8_t BVC();
 extern uint8_t BRK();
+extern uint8_t BRA();
+extern uint8_t PHX(); extern uint8_t PHY(); extern uint8_t PLX(); extern uint8_t PLY();
+extern uint8_t STZ(); extern uint8_t TRB(); extern uint8_t TSB();
+extern uint8_t LAX(); extern uint8_t SAX(); extern uint8_t SLO(); extern uint8_t RLA();
+extern uint8_t SRE(); extern uint8_t RRA(); extern uint8_t DCP(); extern uint8_t ISC();
+extern uint8_t ANC(); extern uint8_t ALR(); extern uint8_t ARR(); extern uint8_t SBX();
+extern uint8_t LAS(); extern uint8_t JAM();
 
 extern void irq();
 extern void nmi();
 
+// Asserts or releases the IRQ line of a device, source is its bit within IRQ_LINES_MASK. Safe to call from any thread.
+extern void cpu_set_irq(Cpu* target, uint32_t source, bool asserted);
+
+// Drives the NMI line, an NMI is latched whenever the line goes from released to asserted. Safe to call from any thread.
+extern void cpu_set_nmi(Cpu* target, bool asserted);
+
+// Asserts and releases the NMI line, latching exactly one NMI.
+extern void cpu_pulse_nmi(Cpu* target);
+
+// True if an NMI is latched or an IRQ line is asserted while interrupts are enabled.
+extern bool interrupt_pending();
+
 extern uint8_t MODE_ACC();
 extern uint8_t MODE_IMP();
 extern uint8_t MODE_IMM();
@@ -105,25 +181,13 @@ extern uint8_t MODE_ZPY();
 extern uint8_t MODE_INX();
 extern uint8_t MODE_INY();
 
-static Instruction instructions[] = {
-    //               0                               1                              2                                 3                             4                             5                             6                               7                             8                               9                               A                              B                              C                               D                             E                             F                                                       
-/* 0 */ { "BRK", &MODE_IMP, &BRK, 7 }, { "ORA", &MODE_INX, &ORA, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ORA", &MODE_ZP,  &ORA, 3 }, { "ASL", &MODE_ZP,  &ASL, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "PHP", &MODE_IMP, &PHP, 3 }, { "ORA", &MODE_IMM, &ORA, 2 }, { "ASL", &MODE_ACC, &ASL, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ORA", &MODE_ABS, &ORA, 4 }, { "ASL", &MODE_ABS, &ASL, 6 }, { "ILL", &MODE_IMP, &ILL, 7 },
-/* 1 */ { "BPL", &MODE_REL, &BPL, 2 }, { "ORA", &MODE_INY, &ORA, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ORA", &MODE_ZPX, &ORA, 4 }, { "ASL", &MODE_ZPX, &ASL, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CLC", &MODE_IMP, &CLC, 2 }, { "ORA", &MODE_ABY, &ORA, 4 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ORA", &MODE_ABX, &ORA, 4 }, { "ASL", &MODE_ABX, &ASL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 },
-/* 2 */ { "JSR", &MODE_ABS, &JSR, 6 }, { "AND", &MODE_INX, &AND, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "BIT", &MODE_ZP,  &BIT, 3 }, { "AND", &MODE_ZP,  &AND, 3 }, { "ROL", &MODE_ZP,  &ROL, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "PLP", &MODE_IMP, &PLP, 4 }, { "AND", &MODE_IMM, &AND, 2 }, { "ROL", &MODE_ACC, &ROL, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "BIT", &MODE_ABS, &BIT, 4 }, { "AND", &MODE_ABS, &AND, 4 }, { "ROL", &MODE_ABS, &ROL, 6 }, { "ILL", &MODE_IMP, &ILL, 7 },
-/* 3 */ { "BMI", &MODE_REL, &BMI, 2 }, { "AND", &MODE_INY, &AND, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "AND", &MODE_ZPX, &AND, 4 }, { "ROL", &MODE_ZPX, &ROL, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "SEC", &MODE_IMP, &SEC, 2 }, { "AND", &MODE_ABY, &AND, 4 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "AND", &MODE_ABX, &AND, 4 }, { "ROL", &MODE_ABX, &ROL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 },
-/* 4 */ { "RTI", &MODE_IMP, &RTI, 6 }, { "EOR", &MODE_INX, &EOR, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "EOR", &MODE_ZP,  &EOR, 3 }, { "LSR", &MODE_ZP,  &LSR, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "PHA", &MODE_IMP, &PHA, 3 }, { "EOR", &MODE_IMM, &EOR, 2 }, { "LSR", &MODE_ACC, &LSR, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "JMP", &MODE_ABS, &JMP, 3 }, { "EOR", &MODE_ABS, &EOR, 4 }, { "LSR", &MODE_ABS, &LSR, 6 }, { "ILL", &MODE_IMP, &ILL, 7 },
-/* 5 */ { "BVC", &MODE_REL, &BVC, 2 }, { "EOR", &MODE_INY, &EOR, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "EOR", &MODE_ZPX, &EOR, 4 }, { "LSR", &MODE_ZPX, &LSR, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CLI", &MODE_IMP, &CLI, 2 }, { "EOR", &MODE_ABY, &EOR, 4 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "EOR", &MODE_ABX, &EOR, 4 }, { "LSR", &MODE_ABX, &LSR, 7 }, { "ILL", &MODE_IMP, &ILL, 7 },
-/* 6 */ { "RTS", &MODE_IMP, &RTS, 6 }, { "ADC", &MODE_INX, &ADC, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ADC", &MODE_ZP,  &ADC, 3 }, { "ROR", &MODE_ZP,  &ROR, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "PLA", &MODE_IMP, &PLA, 4 }, { "ADC", &MODE_IMM, &ADC, 2 }, { "ROR", &MODE_ACC, &ROR, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "JMP", &MODE_IND, &JMP, 5 }, { "ADC", &MODE_ABS, &ADC, 4 }, { "ROR", &MODE_ABS, &ROR, 6 }, { "ILL", &MODE_IMP, &ILL, 7 },
-/* 7 */ { "BVS", &MODE_REL, &BVS, 2 }, { "ADC", &MODE_INY, &ADC, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ADC", &MODE_ZPX, &ADC, 4 }, { "ROR", &MODE_ZPX, &ROR, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "SEI", &MODE_IMP, &SEI, 2 }, { "ADC", &MODE_ABY, &ADC, 4 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ADC", &MODE_ABX, &ADC, 4 }, { "ROR", &MODE_ABX, &ROR, 7 }, { "ILL", &MODE_IMP, &ILL, 7 },
-/* 8 */ { "ILL", &MODE_IMP, &ILL, 7 }, { "STA", &MODE_INX, &STA, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "STY", &MODE_ZP,  &STY, 3 }, { "STA", &MODE_ZP,  &STA, 3 }, { "STX", &MODE_ZP,  &STX, 3 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "DEY", &MODE_IMP, &DEY, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "TXA", &MODE_IMP, &TXA, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "STY", &MODE_ABS, &STY, 4 }, { "STA", &MODE_ABS, &STA, 4 }, { "STX", &MODE_ABS, &STX, 4 }, { "ILL", &MODE_IMP, &ILL, 7 },
-/* 9 */ { "BCC", &MODE_REL, &BCC, 2 }, { "STA", &MODE_INY, &STA, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "STY", &MODE_ZPX, &STY, 4 }, { "STA", &MODE_ZPX, &STA, 4 }, { "STX", &MODE_ZPX, &STX, 4 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "TYA", &MODE_IMP, &TYA, 2 }, { "STA", &MODE_ABY, &STA, 5 }, { "TXS", &MODE_IMP, &TXS, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "STA", &MODE_ABX, &STA, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 },
-/* A */ { "LDY", &MODE_IMM, &LDY, 2 }, { "LDA", &MODE_INX, &LDA, 6 }, { "LDX", &MODE_IMM, &LDX, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "LDY", &MODE_ZP,  &LDY, 3 }, { "LDA", &MODE_ZP,  &LDA, 3 }, { "LDX", &MODE_ZP,  &LDX, 3 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "TAY", &MODE_IMP, &TAY, 2 }, { "LDA", &MODE_IMM, &LDA, 2 }, { "TAX", &MODE_IMP, &TAX, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "LDY", &MODE_ABS, &LDY, 4 }, { "LDA", &MODE_ABS, &LDA, 4 }, { "LDX", &MODE_ABS, &LDX, 4 }, { "ILL", &MODE_IMP, &ILL, 7 },
-/* B */ { "BCS", &MODE_REL, &ILL, 2 }, { "LDA", &MODE_INY, &LDA, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "LDY", &MODE_ZPX, &LDY, 4 }, { "LDA", &MODE_ZPX, &LDA, 4 }, { "LDX", &MODE_ZPY, &LDX, 4 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CLV", &MODE_IMP, &CLV, 2 }, { "LDA", &MODE_ABY, &LDA, 4 }, { "TSX", &MODE_IMP, &TSX, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "LDY", &MODE_ABX, &LDY, 4 }, { "LDA", &MODE_ABX, &LDA, 4 }, { "LDX", &MODE_ABY, &LDX, 4 }, { "ILL", &MODE_IMP, &ILL, 7 },
-/* C */ { "CPY", &MODE_IMM, &CPY, 2 }, { "CMP", &MODE_INX, &CMP, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CPY", &MODE_ZP,  &CPY, 3 }, { "CMP", &MODE_ZP,  &CMP, 3 }, { "DEC", &MODE_ZP,  &DEC, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "INY", &MODE_IMP, &INY, 2 }, { "CMP", &MODE_IMM, &CMP, 2 }, { "DEX", &MODE_IMP, &DEX, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CPY", &MODE_ABS, &CPY, 4 }, { "CMP", &MODE_ABS, &CMP, 4 }, { "DEC", &MODE_ABS, &DEC, 6 }, { "ILL", &MODE_IMP, &ILL, 7 },
-/* D */ { "BNE", &MODE_REL, &BNE, 2 }, { "CMP", &MODE_INY, &CMP, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CMP", &MODE_ZPX, &CMP, 4 }, { "DEC", &MODE_ZPX, &DEC, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CLD", &MODE_IMP, &CLD, 2 }, { "CMP", &MODE_ABY, &CMP, 4 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CMP", &MODE_ABX, &CMP, 4 }, { "DEC", &MODE_ABX, &DEC, 7 }, { "ILL", &MODE_IMP, &ILL, 7 },
-/* E */ { "CPX", &MODE_IMM, &CPX, 2 }, { "SBC", &MODE_INX, &SBC, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CPX", &MODE_ZP,  &CPX, 3 }, { "SBC", &MODE_ZP,  &SBC, 3 }, { "INC", &MODE_ZP,  &INC, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "INX", &MODE_IMP, &INX, 2 }, { "SBC", &MODE_IMM, &SBC, 2 }, { "NOP", &MODE_IMP, &NOP, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CPX", &MODE_ABS, &CPX, 4 }, { "SBC", &MODE_ABS, &SBC, 4 }, { "INC", &MODE_ABS, &INC, 6 }, { "ILL", &MODE_IMP, &ILL, 7 },
-/* F */ { "BEQ", &MODE_REL, &BEQ, 2 }, { "SBC", &MODE_INY, &SBC, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "SBC", &MODE_ZPX, &SBC, 4 }, { "INC", &MODE_ZPX, &INC, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "SED", &MODE_IMP, &SED, 2 }, { "SBC", &MODE_ABY, &SBC, 4 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "SBC", &MODE_ABX, &SBC, 4 }, { "INC", &MODE_ABX, &INC, 7 }, { "ILL", &MODE_IMP, &ILL, 7 },
-
-};
+extern uint8_t MODE_ZPI();
+extern uint8_t MODE_IAX();
+
+// Indexed by opcode, shared by the interpreter and the tools and never changed at run time.
+extern const Instruction instructions[256];
+
+// True for the opcodes the undocumented opcode policy applies to, never on the 65C02.
+extern bool cpu_undocumented(uint8_t opcode);
 
 #endif // !CPU_H
\ No newline at end of file
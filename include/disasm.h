@@ -0,0 +1,106 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define DISASM_MEMORY_SIZE 0x10000
+#define DISASM_MAX_SUCCESSORS 2
+
+typedef enum {
+    ADDR_IMP, ADDR_ACC, ADDR_IMM,
+    ADDR_ABS, ADDR_ZP, ADDR_REL,
+    ADDR_IND, ADDR_ABX, ADDR_ABY,
+    ADDR_ZPX, ADDR_ZPY,
+    ADDR_INX, ADDR_INY,
+    ADDR_ZPI, ADDR_IAX,
+} AddressModeKind;
+
+// How an instruction affects the flow of control.
+typedef enum {
+    FLOW_NONE,          // Falls through to the next instruction.
+    FLOW_BRANCH,        // Conditional relative branch, target or fall through.
+    FLOW_JUMP,          // JMP to an absolute address.
+    FLOW_JUMP_INDIRECT, // JMP through a pointer, the target is unknown statically.
+    FLOW_CALL,          // JSR, continues after the call when the subroutine returns.
+    FLOW_RETURN,        // RTS and RTI.
+    FLOW_BREAK,         // BRK, continues at the IRQ vector.
+    FLOW_ILLEGAL,       // An opcode this core does not implement, tracing stops here.
+} FlowKind;
+
+typedef struct {
+    AddressModeKind mode;
+    FlowKind flow;
+    uint8_t length;
+} OpcodeInfo;
+
+typedef struct {
+    uint16_t address;
+    uint8_t opcode;
+    uint8_t length;
+    AddressModeKind mode;
+    FlowKind flow;
+    uint16_t operand;   // The raw 8 or 16 bit operand.
+    uint16_t target;    // The destination of branches, jumps and calls.
+} DisasmInstruction;
+
+// Flags kept for every address of the image during analysis.
+typedef enum {
+    DISASM_CODE = 0x01,         // First byte of a decoded instruction.
+    DISASM_OPERAND = 0x02,      // Operand byte of a decoded instruction.
+    DISASM_LEADER = 0x04,       // First instruction of a basic block.
+    DISASM_FUNCTION = 0x08,     // Entry point or the target of a JSR.
+    DISASM_JUMP_TARGET = 0x10,  // Target of a branch or jump.
+    DISASM_ENTRY = 0x20,        // Entry point handed to the analyzer.
+} DisasmFlags;
+
+typedef struct {
+    uint16_t start;
+    uint32_t end;           // Address one past the last byte of the block.
+    uint16_t last;          // Address of the last instruction in the block.
+    uint16_t function;      // Entry of the function that first reached this block.
+    uint16_t instruction_count;
+    uint8_t successor_count;
+    uint16_t successors[DISASM_MAX_SUCCESSORS];
+    FlowKind exit;
+} DisasmBlock;
+
+typedef struct {
+    uint16_t caller;        // Function containing the JSR.
+    uint16_t site;          // Address of the JSR.
+    uint16_t callee;
+} DisasmCall;
+
+typedef struct {
+    const uint8_t* memory;
+    uint8_t flags[DISASM_MEMORY_SIZE];
+    int32_t block_index[DISASM_MEMORY_SIZE];    // Block starting at an address or -1.
+
+    DisasmBlock* blocks;
+    size_t block_count;
+
+    DisasmCall* calls;
+    size_t call_count;
+} DisasmAnalysis;
+
+extern const OpcodeInfo* disasm_opcode_info(uint8_t opcode);
+
+extern void disasm_decode(const uint8_t* memory, uint16_t address, DisasmInstruction* instruction);
+
+extern int disasm_format(const DisasmInstruction* instruction, char* buf, size_t size);
+
+extern DisasmAnalysis* disasm_analyze(const uint8_t* memory, const uint16_t* entries, size_t entry_count);
+
+extern void disasm_free(DisasmAnalysis* analysis);
+
+extern const DisasmBlock* disasm_block_at(const DisasmAnalysis* analysis, uint16_t address);
+
+extern void disasm_print_listing(const DisasmAnalysis* analysis, uint16_t start, uint32_t end, FILE* out);
+
+extern void disasm_print_linear(const uint8_t* memory, uint16_t start, uint32_t end, FILE* out);
+
+extern void disasm_print_call_graph(const DisasmAnalysis* analysis, FILE* out);
+
+#endif // !DISASM_H
@@ -0,0 +1,80 @@
+#ifndef EMU6502_H
+#define EMU6502_H
+
+// The public interface of libemu6502. Only what is declared here is exported by the shared library,
+// machines are opaque handles so the internals can change without breaking hosts.
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(_WIN32)
+#define EMU6502_API
+#else
+#define EMU6502_API __attribute__((visibility("default")))
+#endif
+
+// Bumped whenever a declaration below changes incompatibly.
+#define EMU6502_API_VERSION 1
+
+typedef struct Emu6502 Emu6502;
+
+typedef struct {
+    uint8_t a, x, y;
+    uint8_t status;
+    uint8_t sp;
+    uint16_t pc;
+    uint64_t cycles;        // Read only, the clock count since the last reset.
+    uint64_t instructions;  // Read only, instructions retired since the machine was created.
+} Emu6502Registers;
+
+EMU6502_API int emu6502_api_version(void);
+
+// A machine with 64 KiB of zeroed ram and no devices. Returns NULL if it cannot be allocated.
+EMU6502_API Emu6502* emu6502_create(void);
+
+EMU6502_API void emu6502_destroy(Emu6502* machine);
+
+// Copies the image into ram at address and points the reset vector at it unless the image covers
+// the vector itself. Returns false if the image does not fit below the top of memory.
+EMU6502_API bool emu6502_load(Emu6502* machine, uint16_t address, const uint8_t* image, size_t length);
+
+// Assembles the source into ram, see asm.h for the syntax. The reset vector is pointed at the first
+// byte emitted unless the source stores a non-zero vector at 0xFFFC itself. On failure the vector
+// is left as it was and a message with the line is copied to error, which may be NULL.
+EMU6502_API bool emu6502_assemble(Emu6502* machine, const char* source, char* error, size_t error_size);
+
+// Resets the cpu, it starts at the reset vector once the reset cycles have passed.
+EMU6502_API void emu6502_reset(Emu6502* machine);
+
+// Runs up to cycles clock cycles and returns how many ran, fewer only when the cpu halted on a JAM.
+EMU6502_API uint64_t emu6502_run(Emu6502* machine, uint64_t cycles);
+
+// Copies length bytes of ram starting at address, wrapping at the top of memory. Devices are not
+// involved and the bus counters do not move, this is the host looking at the ram directly.
+EMU6502_API void emu6502_read(Emu6502* machine, uint16_t address, uint8_t* buffer, size_t length);
+
+EMU6502_API void emu6502_write(Emu6502* machine, uint16_t address, const uint8_t* data, size_t length);
+
+EMU6502_API void emu6502_get_registers(Emu6502* machine, Emu6502Registers* registers);
+
+// Sets a, x, y, status, sp and pc. The counters are ignored.
+EMU6502_API void emu6502_set_registers(Emu6502* machine, const Emu6502Registers* registers);
+
+// Drives an IRQ line, source is one bit of 0x3FFFFFFF per device. Safe to call from any thread.
+EMU6502_API void emu6502_set_irq(Emu6502* machine, uint32_t source, bool asserted);
+
+// Latches one NMI. Safe to call from any thread.
+EMU6502_API void emu6502_nmi(Emu6502* machine);
+
+EMU6502_API bool emu6502_halted(Emu6502* machine);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !EMU6502_H
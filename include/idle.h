@@ -0,0 +1,42 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "../include/cpu.h"
+
+// Loops longer than this are not worth watching, busy waits are a handful of instructions.
+#define IDLE_MAX_INSTRUCTIONS 16
+
+// How far a run loop without a deadline of its own lets one skip go.
+#define IDLE_MAX_SKIP 0x1000000
+
+// Watches for a loop that goes round without changing anything: the registers are the same each
+// time it jumps back, it writes nothing and only makes quiet device reads, like polling a status
+// register. Until a device changes by itself every further iteration is the same, so the clock
+// can move on by whole iterations at once up to the next device event.
+typedef struct {
+    uint16_t head;              // Where the last backward jump went.
+    uint8_t a, x, y, status, sp;
+    uint64_t clock_count;
+    uint64_t instruction_count;
+    uint64_t read_count;
+    uint64_t write_count;
+    uint64_t mmio_count;
+    uint64_t effect_count;
+    bool armed;
+
+    uint64_t skips;
+    uint64_t skipped_cycles;
+} IdleDetector;
+
+extern void idle_init(IdleDetector* idle);
+
+// Called by run loops after an instruction of the selected cpu that jumped back to or behind its
+// own address. Moves the clock forward by whole iterations of an idle loop, stopping before limit
+// and before the next event of a device on the bus, and returns whether it did. Nothing is skipped
+// while an interrupt is pending or a replay runs. Devices other threads drive, like mailboxes, can
+// change during a skip, limit bounds how late the loop sees it.
+extern bool idle_check(IdleDetector* idle, Cpu* cpu, uint64_t limit);
+
+#endif // !IDLE_H
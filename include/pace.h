@@ -0,0 +1,62 @@
+#ifndef PACE_H
+#define PACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#define PACE_NES_HZ 1789773
+#define PACE_DEFAULT_BURST_NS 1000000   // Bursts are a millisecond of guest time unless given.
+#define PACE_DEFAULT_SPIN_NS 50000      // The last stretch before a deadline is spun instead of slept.
+#define PACE_DEFAULT_MAX_LAG_NS 100000000
+
+// What to do when a burst ends after its deadline because the host fell behind.
+typedef enum {
+    PACE_CATCH_UP,      // Run the following bursts without waiting until the guest is back on time, up to max_lag_ns.
+    PACE_DROP,          // Forget the lost time, the guest runs on time from now on.
+} PacePolicy;
+
+// Keeps the guest at hz cycles per second of the monotonic clock. The run loop executes burst
+// cycles flat out and calls pace_wait, which sleeps until the wall clock reaches the time those
+// cycles take on real hardware and spins for the last spin_ns to wake on time.
+typedef struct {
+    uint64_t hz;
+    uint32_t burst;             // Cycles per burst.
+    PacePolicy policy;
+    uint64_t spin_ns;
+    uint64_t max_lag_ns;
+
+    uint64_t start_ns;
+    uint64_t start_cycle;
+
+    // What was measured, the jitter is how late pace_wait returned after each deadline it waited for.
+    uint64_t bursts;
+    uint64_t waits;
+    uint64_t late;              // Bursts that ended after their deadline.
+    uint64_t late_max_ns;       // How far behind the latest of them ended.
+    double late_sum_ns;
+    uint64_t dropped_ns;        // Wall clock time the guest lost to PACE_DROP or to max_lag_ns.
+    uint64_t jitter_max_ns;
+    double jitter_sum_ns;
+    double jitter_square_sum_ns;
+
+    // How late the sleep woke after the time it was asked for, before the spin hides it.
+    uint64_t sleeps;
+    uint64_t overslept;         // Sleeps that woke past the deadline itself, the spin could not help.
+    uint64_t oversleep_max_ns;
+    double oversleep_sum_ns;
+} Pacer;
+
+// A pacer at hz with a burst of cycles, 0 picks PACE_DEFAULT_BURST_NS worth. A hz of 0 is turbo,
+// what the emulator runs without -f: pace_wait returns at once and the schedule follows the guest.
+extern void pace_init(Pacer* pacer, uint64_t hz, uint32_t burst, PacePolicy policy);
+
+// Starts the schedule with the guest at cycle.
+extern void pace_start(Pacer* pacer, uint64_t cycle);
+
+// Called after each burst with the guest's clock count, returns once the wall clock has caught up with it.
+extern void pace_wait(Pacer* pacer, uint64_t cycle);
+
+extern void pace_report(const Pacer* pacer, FILE* out);
+
+#endif // !PACE_H
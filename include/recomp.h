@@ -0,0 +1,31 @@
+#ifndef RECOMP_H
+#define RECOMP_H
+
+#include <stdint.h>
+#include "../include/cpu.h"
+
+// A basic block translated to C by recomp6502. It is only run while the bytes it was translated
+// from are still in memory, self-modifying code falls back to the interpreter. Stores that may hit
+// the rest of the block return to the dispatcher after they ran, so it checks the bytes again.
+typedef struct {
+    uint16_t start;
+    uint16_t length;
+    void (*run)(Cpu* cpu);
+} RecompBlock;
+
+typedef struct {
+    const char* name;
+    const uint8_t* image;
+    uint16_t origin;
+    uint32_t size;
+    uint32_t program_end;           // The interpreter loop stops once the pc reaches this.
+    const RecompBlock* const* blocks;   // Indexed by address - origin, NULL where no block starts.
+} RecompProgram;
+
+// Runs translated blocks while the pc is on one and interprets everything else, like indirect jump targets.
+extern void recomp_run(const RecompProgram* program);
+
+// Loads the image, resets the cpu and runs the program like the emulator's main.
+extern int recomp_main(const RecompProgram* program);
+
+#endif // !RECOMP_H
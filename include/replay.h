@@ -0,0 +1,101 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "../include/cpu.h"
+
+#define REPLAY_MAGIC 0x594C5052    // "RPLY"
+#define REPLAY_VERSION 2
+
+// Cycles between two snapshots. Once REPLAY_MAX_SNAPSHOTS are kept every other one is dropped and
+// the interval doubles, so any length of run is covered with bounded memory.
+#define REPLAY_SNAPSHOT_INTERVAL 0x100000
+#define REPLAY_MAX_SNAPSHOTS 256
+
+typedef enum {
+    REPLAY_RECORD,  // Inputs are logged, past the end of the log they come live from the devices.
+    REPLAY_PLAY,    // Inputs come from a loaded log, past its end they come live and are not logged.
+} ReplayMode;
+
+typedef enum {
+    REPLAY_EVENT_INTERRUPTS,    // The interrupt lines changed, the value is the whole word.
+    REPLAY_EVENT_INPUT,         // A device or the host handed the cpu a byte.
+    REPLAY_EVENT_BLOCK,         // A device handed the cpu a run of bytes, the value is how many.
+} ReplayEventKind;
+
+typedef struct {
+    uint64_t cycle;
+    ReplayEventKind kind;
+    uint8_t source;
+    uint32_t value;
+    const uint8_t* data;        // The bytes of a block event.
+} ReplayEvent;
+
+// The cpu, the bus with its ram, and where the log is at a cycle. Device state is not included,
+// a seek relies on the devices handing the cpu their inputs through the log, so registers a
+// device keeps itself, like the block device's sector and dma address, are not rewound.
+typedef struct {
+    Cpu cpu;
+    Bus bus;
+    uint8_t* ram;
+    size_t cursor;
+    uint64_t event_cycle;
+    uint32_t lines;
+} ReplaySnapshot;
+
+// The log is kept in memory as a byte stream. Every event is a varint cycle delta from the event
+// before it, a kind byte and its payload, so a quiet run records almost nothing.
+struct Replay {
+    ReplayMode mode;
+    Cpu* cpu;
+    uint32_t ram_hash;      // Hash of the ram when recording started, checked on load.
+
+    uint8_t* events;
+    size_t length;
+    size_t capacity;
+    size_t cursor;          // Next event to play back, the log is recording once it equals length.
+    uint64_t event_cycle;   // Cycle of the event before the cursor, the base of the next delta.
+    uint32_t lines;         // Interrupt lines as last logged or played back.
+    bool diverged;
+
+    ReplaySnapshot* snapshots;
+    size_t snapshot_count;
+    uint64_t snapshot_interval;
+    uint64_t next_snapshot;
+};
+
+// Starts logging the inputs of the cpu, which has to be reset with its rom loaded.
+extern Replay* replay_record(Cpu* cpu);
+
+// Loads a log written by replay_save to play it back on the cpu, which has to be reset with the same rom loaded.
+extern Replay* replay_load(Cpu* cpu, const char* path);
+
+extern bool replay_save(const Replay* replay, const char* path);
+
+// Detaches the replay from its cpu.
+extern void replay_free(Replay* replay);
+
+// Called by cpu_clock with the interrupt lines it sampled at an instruction boundary. Returns the
+// lines the cpu has to act on, the live ones while recording and the logged ones on playback.
+extern uint32_t replay_interrupts(Replay* replay, uint32_t lines);
+
+// Devices pass every byte they read from the outside world through here. Returns the live value
+// while recording and the logged one on playback.
+extern uint8_t replay_input(Replay* replay, uint8_t source, uint8_t value);
+
+// Like replay_input for a whole transfer, logged as one event. Returns the live bytes while
+// recording and the logged ones on playback, those stay valid until the replay is freed.
+extern const uint8_t* replay_input_block(Replay* replay, uint8_t source, const uint8_t* data, uint32_t length);
+
+// True while the inputs come from the log, devices should not consume live input then.
+extern bool replay_playing(const Replay* replay);
+
+// Restores the nearest snapshot at or before the cycle and runs forward to it.
+extern bool replay_seek(Replay* replay, uint64_t cycle);
+
+// Goes back to the start of the instruction before the current cycle.
+extern bool replay_step_back(Replay* replay);
+
+#endif // !REPLAY_H
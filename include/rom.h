@@ -0,0 +1,17 @@
+#ifndef ROM_H
+#define ROM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Roms ending in .txt are hex text like program.txt, everything else is a raw binary image.
+extern bool rom_is_hex(const char* filepath);
+
+// Roms ending in .s or .asm are assembly source for asm_assemble.
+extern bool rom_is_source(const char* filepath);
+
+// Reads up to size bytes of the rom into buf. Returns the number of bytes read or -1 if the file cannot be opened.
+extern long rom_read(const char* filepath, bool hex, uint8_t* buf, size_t size);
+
+#endif // !ROM_H
@@ -0,0 +1,67 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "../include/cpu.h"
+
+#define STATS_MAGIC 0x36353032  // "6502"
+#define STATS_VERSION 1
+#define STATS_FILE_PREFIX "emu6502-"
+#define STATS_DEFAULT_DIR "/dev/shm"
+#define STATS_DIR_ENV "EMU6502_STATS_DIR"
+
+// Instructions between two publishes. Idle skips advance the count in big steps, so the run loop
+// compares against a deadline instead of waiting for an exact multiple.
+#define STATS_PUBLISH_INTERVAL 0x10000
+
+typedef struct {
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t bus_reads;
+    uint64_t bus_writes;
+    uint64_t mmio_callbacks;
+    uint64_t interrupts;
+    uint64_t illegal;
+} StatsCounters;
+
+// The block every instance maps into a file in the stats directory. Readers copy it out under
+// the sequence lock, the sequence is odd while the emulator is writing a new sample.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    _Atomic uint32_t sequence;
+    int32_t pid;
+    char name[64];
+
+    uint64_t start_ns;      // Monotonic clock when the instance started.
+    uint64_t update_ns;     // Monotonic clock of the last sample.
+    uint64_t hz;            // Emulated clock rate over the last publish interval.
+    StatsCounters counters;
+} StatsBlock;
+
+typedef struct {
+    StatsBlock* block;
+    char path[256];
+    uint64_t last_ns;
+    uint64_t last_cycles;
+    uint64_t next_instructions;     // Publish again once cpu->instruction_count reaches this.
+} StatsPublisher;
+
+extern const char* stats_directory();
+
+extern uint64_t stats_now_ns();
+
+// Creates the stats file for this process, returns NULL if it cannot be created.
+extern StatsPublisher* stats_open(const char* name);
+
+extern void stats_publish(StatsPublisher* publisher, const Cpu* cpu, const Bus* bus);
+
+// Removes the stats file so readers stop reporting the instance.
+extern void stats_close(StatsPublisher* publisher);
+
+// Copies a consistent sample out of a stats file, returns false if it is not a valid stats block.
+extern bool stats_read(const char* path, StatsBlock* sample);
+
+#endif // !STATS_H
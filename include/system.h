@@ -0,0 +1,93 @@
+#ifndef SYSTEM_H
+#define SYSTEM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include "../include/cpu.h"
+#include "../include/pace.h"
+#include "../include/idle.h"
+#include "../include/stats.h"
+
+#define SYSTEM_MAX_CPUS 8
+#define SYSTEM_MAX_SHARED 4
+#define SYSTEM_MAX_MAILBOXES 16
+#define SYSTEM_MAILBOX_SIZE 256     // Must be a power of two.
+
+// Cycles a cpu runs before the next one gets its turn when they are interleaved on one thread.
+#define SYSTEM_DEFAULT_QUANTUM 128
+
+// Mailbox registers, relative to the page an endpoint is mapped at.
+#define MAILBOX_DATA 0x00       // Sender: write a byte, dropped when full. Receiver: read the next byte, 0 when empty.
+#define MAILBOX_STATUS 0x01     // MAILBOX_STATUS_READY when the sender has room or the receiver has data.
+
+#define MAILBOX_STATUS_READY 0x01
+
+// Ram mapped into the buses of every cpu at the same address. The bytes are accessed atomically
+// so cpus on different threads see each other's stores in order.
+typedef struct {
+    BusDevice device;
+    _Atomic uint8_t* memory;
+    uint16_t base;
+} SharedRam;
+
+// A single producer, single consumer byte queue from one cpu to another. Each side only ever
+// writes its own index, so neither needs a lock.
+typedef struct {
+    BusDevice sender;
+    BusDevice receiver;
+    _Atomic uint32_t head;      // Written by the sender.
+    _Atomic uint32_t tail;      // Written by the receiver.
+    uint8_t data[SYSTEM_MAILBOX_SIZE];
+} Mailbox;
+
+typedef struct {
+    Cpu* cpu;
+    Bus* bus;
+    uint32_t stop_pc;           // The cpu is done once its pc reaches this, like the emulator's program end.
+    IdleDetector idle;          // Skips to the end of the quantum while the cpu spins without touching anything.
+} SystemCpu;
+
+// Several cpus, each with its own bus holding its private ram and devices, plus the regions and
+// mailboxes they share. Cpu 0 is the primary, the system stops when it is done.
+typedef struct {
+    SystemCpu cpus[SYSTEM_MAX_CPUS];
+    size_t cpu_count;
+
+    SharedRam shared[SYSTEM_MAX_SHARED];
+    size_t shared_count;
+
+    Mailbox mailboxes[SYSTEM_MAX_MAILBOXES];
+    size_t mailbox_count;
+
+    uint32_t quantum;
+    Pacer* pacer;               // Paces the primary when set, the others keep up through the mailboxes.
+    bool skip_idle;             // Skip idle loops, on by default. Off steps through them like -w.
+    StatsPublisher* stats;      // Publishes the primary's counters when set.
+    atomic_bool stop;
+} System;
+
+extern void system_init(System* system);
+
+// Frees the shared regions, the cpus and buses stay with the caller.
+extern void system_free(System* system);
+
+// Adds a cpu that is connected to its bus and reset. Returns its index or -1 when the system is full.
+extern int system_add_cpu(System* system, Cpu* cpu, uint32_t stop_pc);
+
+// Maps pages of shared ram at address on the bus of every cpu added so far.
+extern bool system_share(System* system, uint16_t address, uint16_t pages);
+
+// Connects a mailbox from one cpu to another, both endpoints are mapped at address.
+extern bool system_connect(System* system, int from, int to, uint16_t address);
+
+// Runs the cpus in turns of quantum cycles on this thread until cpu 0 is done. The interleaving
+// only depends on the quantum, so runs are repeatable.
+extern void system_run(System* system);
+
+// Runs every cpu on its own thread until cpu 0 is done. The cpus only meet through shared ram
+// and mailboxes, so the interleaving is up to the host.
+extern void system_run_threaded(System* system);
+
+#endif // !SYSTEM_H
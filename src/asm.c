@@ -0,0 +1,898 @@
+#include "../include/asm.h"
+#include "../include/cpu.h"
+#include "../include/disasm.h"
+#include <ctype.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#define ASM_MAX_NAME 64
+#define ASM_MAX_LINE 256
+#define ASM_MODES (ADDR_IAX + 1)
+#define ASM_NOP 0xEA                    // The documented NOP, the undocumented ones share its name and mode.
+#define ASM_NO_OPCODE -1
+#define ASM_MNEMONIC_SLOTS (26 * 26 * 26)
+#define ASM_INITIAL_SYMBOLS 256
+
+typedef struct {
+    int16_t opcodes[ASM_MODES];
+} AsmMnemonic;
+
+typedef struct {
+    char name[ASM_MAX_NAME];
+    int32_t value;
+    int statement;                      // Statement that defined it, later statements may rely on it.
+    bool defined;
+    bool resolved;                      // Its value was known in the first pass where it was defined.
+} AsmSymbol;
+
+typedef struct {
+    char name[ASM_MAX_NAME];
+    char params[ASM_MAX_PARAMS][ASM_MAX_NAME];
+    int param_count;
+    const char* body;
+    size_t length;
+} AsmMacro;
+
+typedef struct {
+    Bus* bus;
+    AsmResult* result;
+    int pass;
+    uint32_t pc;
+    int statement;
+    int line;
+    unsigned expansions;
+    bool failed;
+
+    // Open addressing on the name, the capacity is a power of two.
+    AsmSymbol* symbols;
+    size_t symbol_count;
+    size_t symbol_capacity;
+
+    AsmMacro macros[ASM_MAX_MACROS];
+    size_t macro_count;
+
+    bool emitted;
+    bool first_section_closed;
+} Assembler;
+
+typedef struct {
+    Assembler* as;
+    const char* p;
+    bool known;
+} AsmExpression;
+
+// The opcode of every mnemonic and mode, derived once from instructions[] like the disassembler's decode table.
+static AsmMnemonic mnemonics[256];
+static int16_t mnemonic_slots[ASM_MNEMONIC_SLOTS];
+#ifndef _WIN32
+static pthread_once_t mnemonics_once = PTHREAD_ONCE_INIT;
+#else
+static bool mnemonics_ready = false;
+#endif
+
+static int mnemonic_slot(const char* name, size_t length) {
+    if (length != 3)
+        return -1;
+
+    int slot = 0;
+    for (size_t i = 0; i < 3; i++) {
+        char c = (char) toupper((unsigned char) name[i]);
+        if (c < 'A' || c > 'Z')
+            return -1;
+        slot = slot * 26 + (c - 'A');
+    }
+    return slot;
+}
+
+static void build_mnemonics() {
+    size_t count = 0;
+
+    for (int i = 0; i < ASM_MNEMONIC_SLOTS; i++)
+        mnemonic_slots[i] = ASM_NO_OPCODE;
+
+    for (int opcode = 0; opcode < 256; opcode++) {
+        const Instruction* instruction = &instructions[opcode];
+        if (instruction->opcode == &ILL || instruction->opcode == &JAM)
+            continue;
+
+        int slot = mnemonic_slot(instruction->name, strlen(instruction->name));
+        if (slot < 0)
+            continue;
+        if (mnemonic_slots[slot] == ASM_NO_OPCODE) {
+            mnemonic_slots[slot] = (int16_t) count;
+            for (int mode = 0; mode < ASM_MODES; mode++)
+                mnemonics[count].opcodes[mode] = ASM_NO_OPCODE;
+            count++;
+        }
+
+        // The lowest opcode wins, which picks the documented one everywhere but for NOP.
+        AsmMnemonic* mnemonic = &mnemonics[mnemonic_slots[slot]];
+        AddressModeKind mode = disasm_opcode_info((uint8_t) opcode)->mode;
+        if (mnemonic->opcodes[mode] == ASM_NO_OPCODE || opcode == ASM_NOP)
+            mnemonic->opcodes[mode] = (int16_t) opcode;
+    }
+}
+
+static const AsmMnemonic* find_mnemonic(const char* name, size_t length) {
+    int slot = mnemonic_slot(name, length);
+    if (slot < 0 || mnemonic_slots[slot] == ASM_NO_OPCODE)
+        return NULL;
+    return &mnemonics[mnemonic_slots[slot]];
+}
+
+static void error(Assembler* as, const char* format, ...) {
+    if (as->failed)
+        return;
+
+    va_list arguments;
+    va_start(arguments, format);
+    vsnprintf(as->result->error, sizeof(as->result->error), format, arguments);
+    va_end(arguments);
+
+    as->result->error_line = as->line;
+    as->failed = true;
+}
+
+static const char* skip_space(const char* p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r')
+        p++;
+    return p;
+}
+
+static bool identifier_start(char c) {
+    return isalpha((unsigned char) c) || c == '_';
+}
+
+static bool identifier_char(char c) {
+    return isalnum((unsigned char) c) || c == '_';
+}
+
+static size_t identifier_length(const char* p) {
+    size_t length = 0;
+    if (identifier_start(p[0]))
+        while (identifier_char(p[length]))
+            length++;
+    return length;
+}
+
+static uint32_t hash_name(const char* name, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ (uint8_t) name[i]) * 16777619u;
+    return hash;
+}
+
+static AsmSymbol* find_slot(AsmSymbol* symbols, size_t capacity, const char* name, size_t length) {
+    size_t index = hash_name(name, length) & (capacity - 1);
+    while (symbols[index].name[0] != '\0'
+        && (strncmp(symbols[index].name, name, length) != 0 || symbols[index].name[length] != '\0'))
+        index = (index + 1) & (capacity - 1);
+    return &symbols[index];
+}
+
+// Returns the symbol with the name, adding an undefined one if it is new.
+static AsmSymbol* symbol(Assembler* as, const char* name, size_t length) {
+    if (length >= ASM_MAX_NAME) {
+        error(as, "name '%.*s' is too long", (int) length, name);
+        return NULL;
+    }
+
+    if ((as->symbol_count + 1) * 2 > as->symbol_capacity) {
+        size_t capacity = as->symbol_capacity ? as->symbol_capacity * 2 : ASM_INITIAL_SYMBOLS;
+        AsmSymbol* symbols = calloc(capacity, sizeof(AsmSymbol));
+        if (!symbols) {
+            error(as, "out of memory");
+            return NULL;
+        }
+        for (size_t i = 0; i < as->symbol_capacity; i++)
+            if (as->symbols[i].name[0] != '\0')
+                *find_slot(symbols, capacity, as->symbols[i].name, strlen(as->symbols[i].name)) = as->symbols[i];
+        free(as->symbols);
+        as->symbols = symbols;
+        as->symbol_capacity = capacity;
+    }
+
+    AsmSymbol* entry = find_slot(as->symbols, as->symbol_capacity, name, length);
+    if (entry->name[0] == '\0') {
+        memcpy(entry->name, name, length);
+        entry->name[length] = '\0';
+        as->symbol_count++;
+    }
+    return entry;
+}
+
+static void define(Assembler* as, const char* name, size_t length, int32_t value, bool resolved) {
+    AsmSymbol* entry = symbol(as, name, length);
+    if (!entry)
+        return;
+
+    if (as->pass == 1) {
+        if (entry->defined) {
+            error(as, "'%s' is defined twice", entry->name);
+            return;
+        }
+        entry->defined = true;
+        entry->statement = as->statement;
+        entry->resolved = resolved;
+    }
+    entry->value = value;
+}
+
+static int32_t parse_or(AsmExpression* e);
+
+static int32_t parse_number(AsmExpression* e, int base) {
+    char* end;
+    long value = strtol(e->p, &end, base);
+    if (end == e->p)
+        error(e->as, "bad number");
+    e->p = end;
+    return (int32_t) value;
+}
+
+static int32_t parse_primary(AsmExpression* e) {
+    e->p = skip_space(e->p);
+    char c = *e->p;
+
+    if (c == '$') {
+        e->p++;
+        return parse_number(e, 16);
+    }
+    if (c == '%') {
+        e->p++;
+        return parse_number(e, 2);
+    }
+    if (isdigit((unsigned char) c))
+        return parse_number(e, 0);
+    if (c == '\'' && e->p[1] != '\0' && e->p[2] == '\'') {
+        e->p += 3;
+        return (uint8_t) e->p[-2];
+    }
+    if (c == '*') {
+        e->p++;
+        return (int32_t) e->as->pc;
+    }
+    if (c == '(') {
+        e->p++;
+        int32_t value = parse_or(e);
+        e->p = skip_space(e->p);
+        if (*e->p != ')')
+            error(e->as, "missing )");
+        else
+            e->p++;
+        return value;
+    }
+
+    size_t length = identifier_length(e->p);
+    if (length == 0) {
+        error(e->as, "expected a value");
+        return 0;
+    }
+
+    AsmSymbol* entry = symbol(e->as, e->p, length);
+    e->p += length;
+    if (!entry)
+        return 0;
+
+    // Only symbols defined by earlier statements count as known, so the first pass sees the same as the second.
+    if (!entry->defined || entry->statement > e->as->statement || !entry->resolved)
+        e->known = false;
+    if (!entry->defined) {
+        if (e->as->pass == 2)
+            error(e->as, "'%s' is not defined", entry->name);
+        return 0;
+    }
+    return entry->value;
+}
+
+static int32_t parse_unary(AsmExpression* e) {
+    e->p = skip_space(e->p);
+
+    switch (*e->p) {
+    case '-': e->p++; return -parse_unary(e);
+    case '+': e->p++; return parse_unary(e);
+    case '~': e->p++; return ~parse_unary(e);
+    case '<': e->p++; return parse_unary(e) & 0x00FF;
+    case '>': e->p++; return (parse_unary(e) >> 8) & 0x00FF;
+    default: return parse_primary(e);
+    }
+}
+
+static int32_t parse_product(AsmExpression* e) {
+    int32_t value = parse_unary(e);
+
+    for (;;) {
+        e->p = skip_space(e->p);
+        char op = *e->p;
+        if (op != '*' && op != '/' && op != '%')
+            return value;
+
+        e->p++;
+        int32_t right = parse_unary(e);
+        if (op == '*')
+            value *= right;
+        else if (right == 0) {
+            if (e->known)
+                error(e->as, "division by zero");
+            value = 0;
+        }
+        else
+            value = op == '/' ? value / right : value % right;
+    }
+}
+
+static int32_t parse_sum(AsmExpression* e) {
+    int32_t value = parse_product(e);
+
+    for (;;) {
+        e->p = skip_space(e->p);
+        if (*e->p == '+') { e->p++; value += parse_product(e); }
+        else if (*e->p == '-') { e->p++; value -= parse_product(e); }
+        else return value;
+    }
+}
+
+static int32_t parse_shift(AsmExpression* e) {
+    int32_t value = parse_sum(e);
+
+    for (;;) {
+        e->p = skip_space(e->p);
+        if (e->p[0] == '<' && e->p[1] == '<') { e->p += 2; value = (int32_t) ((uint32_t) value << (parse_sum(e) & 31)); }
+        else if (e->p[0] == '>' && e->p[1] == '>') { e->p += 2; value >>= parse_sum(e) & 31; }
+        else return value;
+    }
+}
+
+static int32_t parse_and(AsmExpression* e) {
+    int32_t value = parse_shift(e);
+    while (*(e->p = skip_space(e->p)) == '&') {
+        e->p++;
+        value &= parse_shift(e);
+    }
+    return value;
+}
+
+static int32_t parse_xor(AsmExpression* e) {
+    int32_t value = parse_and(e);
+    while (*(e->p = skip_space(e->p)) == '^') {
+        e->p++;
+        value ^= parse_and(e);
+    }
+    return value;
+}
+
+static int32_t parse_or(AsmExpression* e) {
+    int32_t value = parse_xor(e);
+    while (*(e->p = skip_space(e->p)) == '|') {
+        e->p++;
+        value |= parse_xor(e);
+    }
+    return value;
+}
+
+// Evaluates the whole text, known tells whether the first pass could rely on the value.
+static int32_t evaluate(Assembler* as, const char* text, bool* known) {
+    AsmExpression e = { as, text, true };
+    int32_t value = parse_or(&e);
+
+    if (*skip_space(e.p) != '\0')
+        error(as, "unexpected '%s'", skip_space(e.p));
+    if (known)
+        *known = e.known;
+    return value;
+}
+
+// Finds the end of the operand part that starts at p, skipping over quotes and parentheses.
+static char* operand_end(char* p, char stop) {
+    int depth = 0;
+
+    for (; *p != '\0'; p++) {
+        if (*p == '"' || *p == '\'') {
+            char quote = *p;
+            for (p++; *p != '\0' && *p != quote; p++)
+                ;
+            if (*p == '\0')
+                return p;
+        }
+        else if (*p == '(')
+            depth++;
+        else if (*p == ')' && depth-- == 0 && stop == ')')
+            return p;
+        else if (*p == stop && depth == 0)
+            return p;
+    }
+    return p;
+}
+
+static void trim(char* text) {
+    size_t length = strlen(text);
+    while (length > 0 && isspace((unsigned char) text[length - 1]))
+        text[--length] = '\0';
+}
+
+// Cuts a trailing ,X or ,Y off the operand and returns the register, or 0 if there is none.
+static char split_index(char* operand) {
+    char* comma = NULL;
+    for (char* p = operand; *(p = operand_end(p, ',')) == ','; p++)
+        comma = p;
+    if (!comma)
+        return 0;
+
+    const char* reg = skip_space(comma + 1);
+    char c = (char) toupper((unsigned char) reg[0]);
+    if ((c != 'X' && c != 'Y') || *skip_space(reg + 1) != '\0')
+        return 0;
+
+    *comma = '\0';
+    trim(operand);
+    return c;
+}
+
+static void emit(Assembler* as, uint8_t data) {
+    if (as->pc > 0xFFFF) {
+        error(as, "code runs past the top of memory");
+        return;
+    }
+
+    if (as->pass == 2) {
+        bus_write(as->bus, (uint16_t) as->pc, data);
+        if (!as->emitted)
+            as->result->start = (uint16_t) as->pc;
+        as->emitted = true;
+        as->result->size++;
+    }
+    as->pc++;
+}
+
+static void emit_word(Assembler* as, int32_t value) {
+    emit(as, value & 0x00FF);
+    emit(as, (value >> 8) & 0x00FF);
+}
+
+static bool fits_byte(int32_t value) {
+    return value >= -128 && value <= 0xFF;
+}
+
+static bool fits_word(int32_t value) {
+    return value >= -32768 && value <= 0xFFFF;
+}
+
+static void check_range(Assembler* as, int32_t value, bool byte) {
+    if (as->pass == 2 && !(byte ? fits_byte(value) : fits_word(value)))
+        error(as, "value %d does not fit in a %s", (int) value, byte ? "byte" : "word");
+}
+
+static void emit_instruction(Assembler* as, const AsmMnemonic* mnemonic, AddressModeKind mode, int32_t value) {
+    emit(as, (uint8_t) mnemonic->opcodes[mode]);
+
+    switch (mode) {
+    case ADDR_IMP:
+    case ADDR_ACC:
+        break;
+    case ADDR_REL: {
+        int32_t offset = value - (int32_t) (as->pc + 1);
+        if (as->pass == 2 && (offset < -128 || offset > 127))
+            error(as, "branch target is %d bytes away", (int) offset);
+        emit(as, offset & 0x00FF);
+        break;
+    }
+    case ADDR_IMM:
+    case ADDR_ZP:
+    case ADDR_ZPX:
+    case ADDR_ZPY:
+    case ADDR_INX:
+    case ADDR_INY:
+    case ADDR_ZPI:
+        check_range(as, value, true);
+        emit(as, value & 0x00FF);
+        break;
+    default:
+        check_range(as, value, false);
+        emit_word(as, value);
+        break;
+    }
+}
+
+static void assemble_instruction(Assembler* as, const char* name, const AsmMnemonic* mnemonic, char* operand) {
+    const int16_t* opcodes = mnemonic->opcodes;
+    AddressModeKind mode;
+    int32_t value = 0;
+    bool known = true;
+
+    if (*operand == '\0' || ((operand[0] == 'A' || operand[0] == 'a') && operand[1] == '\0'))
+        mode = opcodes[ADDR_IMP] != ASM_NO_OPCODE ? ADDR_IMP : ADDR_ACC;
+    else if (*operand == '#') {
+        mode = ADDR_IMM;
+        value = evaluate(as, operand + 1, NULL);
+    }
+    else if (opcodes[ADDR_REL] != ASM_NO_OPCODE) {
+        mode = ADDR_REL;
+        value = evaluate(as, operand, NULL);
+    }
+    else {
+        // (zp,X), (zp),Y and (address) when the parentheses enclose the whole operand, an expression otherwise.
+        char* close = *operand == '(' ? operand_end(operand + 1, ')') : NULL;
+        const char* rest = close && *close == ')' ? skip_space(close + 1) : NULL;
+        char index = 0;
+
+        if (rest && (*rest == '\0' || (rest[0] == ',' && toupper((unsigned char) *skip_space(rest + 1)) == 'Y'
+            && *skip_space(skip_space(rest + 1) + 1) == '\0'))) {
+            bool post_indexed = *rest == ',';
+            *close = '\0';
+            char* inner = operand + 1;
+            index = split_index(inner);
+
+            if (post_indexed && index == 0)
+                mode = ADDR_INY;
+            else if (!post_indexed && index == 'X')
+                mode = opcodes[ADDR_INX] != ASM_NO_OPCODE ? ADDR_INX : ADDR_IAX;
+            else if (!post_indexed && index == 0)
+                mode = opcodes[ADDR_IND] != ASM_NO_OPCODE ? ADDR_IND : ADDR_ZPI;
+            else {
+                error(as, "bad indirect operand");
+                return;
+            }
+            value = evaluate(as, inner, NULL);
+        }
+        else {
+            index = split_index(operand);
+            value = evaluate(as, operand, &known);
+
+            AddressModeKind zero_page = index == 'X' ? ADDR_ZPX : index == 'Y' ? ADDR_ZPY : ADDR_ZP;
+            AddressModeKind absolute = index == 'X' ? ADDR_ABX : index == 'Y' ? ADDR_ABY : ADDR_ABS;
+
+            // The zero page form needs a value known in the first pass, or the size could change in the second.
+            if (opcodes[zero_page] != ASM_NO_OPCODE
+                && (opcodes[absolute] == ASM_NO_OPCODE || (known && value >= 0 && value <= 0xFF)))
+                mode = zero_page;
+            else
+                mode = absolute;
+        }
+    }
+
+    if (as->failed)
+        return;
+    if (opcodes[mode] == ASM_NO_OPCODE) {
+        error(as, "%.3s has no such addressing mode", name);
+        return;
+    }
+    emit_instruction(as, mnemonic, mode, value);
+}
+
+static void assemble_data(Assembler* as, char* operand, bool words) {
+    while (!as->failed) {
+        char* end = operand_end(operand, ',');
+        bool last = *end == '\0';
+        *end = '\0';
+
+        char* item = (char*) skip_space(operand);
+        trim(item);
+        size_t length = strlen(item);
+
+        if (!words && length >= 2 && item[0] == '"' && item[length - 1] == '"') {
+            for (size_t i = 1; i + 1 < length; i++)
+                emit(as, (uint8_t) item[i]);
+        }
+        else {
+            int32_t value = evaluate(as, item, NULL);
+            check_range(as, value, !words);
+            if (words)
+                emit_word(as, value);
+            else
+                emit(as, value & 0x00FF);
+        }
+
+        if (last)
+            return;
+        operand = end + 1;
+    }
+}
+
+static void close_first_section(Assembler* as) {
+    if (as->pass == 2 && as->emitted && !as->first_section_closed) {
+        as->result->end = (uint16_t) as->pc;
+        as->first_section_closed = true;
+    }
+}
+
+static void assemble_directive(Assembler* as, const char* name, size_t length, char* operand) {
+    if (length == 4 && strncmp(name, ".org", 4) == 0) {
+        bool known;
+        int32_t value = evaluate(as, operand, &known);
+        if (!known)
+            error(as, ".org needs a value known where it is used");
+        else if (value < 0 || value > 0xFFFF)
+            error(as, ".org address %d is outside memory", (int) value);
+        else {
+            close_first_section(as);
+            as->pc = (uint32_t) value;
+        }
+    }
+    else if (length == 5 && strncmp(name, ".byte", 5) == 0)
+        assemble_data(as, operand, false);
+    else if (length == 5 && strncmp(name, ".word", 5) == 0)
+        assemble_data(as, operand, true);
+    else if (length == 5 && strncmp(name, ".endm", 5) == 0)
+        error(as, ".endm without .macro");
+    else
+        error(as, "unknown directive '%.*s'", (int) length, name);
+}
+
+static void assemble_text(Assembler* as, const char* text, size_t length, int depth);
+
+// Appends text to a growing buffer, returns false when it cannot grow.
+static bool append(char** buffer, size_t* length, size_t* capacity, const char* text, size_t count) {
+    if (*length + count + 1 > *capacity) {
+        size_t grown = (*length + count + 1) * 2;
+        char* larger = realloc(*buffer, grown);
+        if (!larger)
+            return false;
+        *buffer = larger;
+        *capacity = grown;
+    }
+    memcpy(*buffer + *length, text, count);
+    *length += count;
+    (*buffer)[*length] = '\0';
+    return true;
+}
+
+static void expand_macro(Assembler* as, const AsmMacro* macro, char* operand, int depth) {
+    const char* arguments[ASM_MAX_PARAMS];
+    int argument_count = 0;
+
+    if (depth + 1 >= ASM_MAX_DEPTH) {
+        error(as, "macros nest deeper than %d", ASM_MAX_DEPTH);
+        return;
+    }
+
+    while (*skip_space(operand) != '\0' && argument_count < ASM_MAX_PARAMS + 1) {
+        char* end = operand_end(operand, ',');
+        bool last = *end == '\0';
+        *end = '\0';
+        trim(operand);
+        if (argument_count < ASM_MAX_PARAMS)
+            arguments[argument_count] = skip_space(operand);
+        argument_count++;
+        if (last)
+            break;
+        operand = end + 1;
+    }
+    if (argument_count != macro->param_count) {
+        error(as, "%s takes %d arguments, not %d", macro->name, macro->param_count, argument_count);
+        return;
+    }
+
+    char* expanded = NULL;
+    size_t length = 0, capacity = 0;
+    char unique[16];
+    snprintf(unique, sizeof(unique), "%u", as->expansions++);
+
+    bool ok = append(&expanded, &length, &capacity, "", 0);
+    for (size_t i = 0; ok && i < macro->length;) {
+        const char* p = macro->body + i;
+        size_t word = identifier_length(p);
+
+        if (p[0] == '\\' && i + 1 < macro->length && p[1] == '@') {
+            ok = append(&expanded, &length, &capacity, unique, strlen(unique));
+            i += 2;
+        }
+        else if (word > 0 && (i == 0 || !identifier_char(p[-1]))) {
+            const char* replacement = p;
+            size_t replacement_length = word;
+            for (int j = 0; j < macro->param_count; j++) {
+                if (strlen(macro->params[j]) == word && strncmp(macro->params[j], p, word) == 0) {
+                    replacement = arguments[j];
+                    replacement_length = strlen(arguments[j]);
+                }
+            }
+            ok = append(&expanded, &length, &capacity, replacement, replacement_length);
+            i += word;
+        }
+        else {
+            ok = append(&expanded, &length, &capacity, p, 1);
+            i++;
+        }
+    }
+
+    if (!ok)
+        error(as, "out of memory");
+    else
+        assemble_text(as, expanded, length, depth + 1);
+    free(expanded);
+}
+
+static const AsmMacro* find_macro(Assembler* as, const char* name, size_t length) {
+    for (size_t i = 0; i < as->macro_count; i++)
+        if (strlen(as->macros[i].name) == length && strncmp(as->macros[i].name, name, length) == 0)
+            return &as->macros[i];
+    return NULL;
+}
+
+static void assemble_line(Assembler* as, char* line, int depth) {
+    as->statement++;
+
+    char* p = (char*) skip_space(line);
+    size_t length = identifier_length(p);
+
+    // A label or a constant in front of the statement.
+    if (length > 0) {
+        const char* after = skip_space(p + length);
+        if (*after == ':') {
+            define(as, p, length, (int32_t) as->pc, true);
+            p = (char*) skip_space(after + 1);
+        }
+        else if (*after == '=') {
+            bool known;
+            int32_t value = evaluate(as, after + 1, &known);
+            define(as, p, length, value, known);
+            return;
+        }
+    }
+    if (*p == '\0' || as->failed)
+        return;
+
+    const char* name = p;
+    length = *p == '.' ? identifier_length(p + 1) + 1 : identifier_length(p);
+    if (length == 0) {
+        error(as, "unexpected '%s'", p);
+        return;
+    }
+    char* operand = (char*) skip_space(p + length);
+    trim(operand);
+
+    if (*name == '.') {
+        assemble_directive(as, name, length, operand);
+        return;
+    }
+
+    const AsmMacro* macro = find_macro(as, name, length);
+    const AsmMnemonic* mnemonic = find_mnemonic(name, length);
+    if (macro)
+        expand_macro(as, macro, operand, depth);
+    else if (mnemonic)
+        assemble_instruction(as, name, mnemonic, operand);
+    else
+        error(as, "unknown instruction '%.*s'", (int) length, name);
+}
+
+// Copies one line without its comment, returns false when it is too long.
+static bool read_line(const char* text, size_t length, char* line) {
+    bool quoted = false;
+    char quote = 0;
+    size_t count = 0;
+
+    for (size_t i = 0; i < length; i++) {
+        char c = text[i];
+        if (quoted && c == quote)
+            quoted = false;
+        else if (!quoted && (c == '"' || c == '\'')) {
+            quoted = true;
+            quote = c;
+        }
+        else if (!quoted && c == ';')
+            break;
+
+        if (count + 1 == ASM_MAX_LINE)
+            return false;
+        line[count++] = c;
+    }
+    line[count] = '\0';
+    trim(line);
+    return true;
+}
+
+static bool directive_is(const char* line, const char* directive) {
+    const char* p = skip_space(line);
+    size_t length = strlen(directive);
+    return strncmp(p, directive, length) == 0 && !identifier_char(p[length]);
+}
+
+// Records the macro whose .macro line is at text and returns where the lines after its .endm start.
+static const char* define_macro(Assembler* as, const char* line, const char* body, const char* end, int depth) {
+    const char* p = skip_space(skip_space(line) + strlen(".macro"));
+    size_t length = identifier_length(p);
+    AsmMacro macro;
+    memset(&macro, 0, sizeof(AsmMacro));
+
+    if (depth > 0)
+        error(as, "macros cannot be defined inside macros");
+    else if (length == 0 || length >= ASM_MAX_NAME)
+        error(as, "bad macro name");
+    else if (as->pass == 1 && (find_macro(as, p, length) || find_mnemonic(p, length)))
+        error(as, "'%.*s' is already defined", (int) length, p);
+    else if (as->pass == 1 && as->macro_count == ASM_MAX_MACROS)
+        error(as, "more than %d macros", ASM_MAX_MACROS);
+    memcpy(macro.name, p, length < ASM_MAX_NAME ? length : 0);
+
+    for (p = skip_space(p + length); !as->failed && *p != '\0';) {
+        size_t param = identifier_length(p);
+        if (param == 0 || param >= ASM_MAX_NAME || macro.param_count == ASM_MAX_PARAMS) {
+            error(as, "bad macro parameter");
+            break;
+        }
+        memcpy(macro.params[macro.param_count++], p, param);
+        p = skip_space(p + param);
+        if (*p == ',')
+            p = skip_space(p + 1);
+    }
+
+    // The body runs to the .endm, which has to be on a line of its own.
+    macro.body = body;
+    char scratch[ASM_MAX_LINE];
+    while (body < end) {
+        const char* eol = memchr(body, '\n', (size_t) (end - body));
+        if (!eol)
+            eol = end;
+        as->line++;
+        if (read_line(body, (size_t) (eol - body), scratch) && directive_is(scratch, ".endm")) {
+            macro.length = (size_t) (body - macro.body);
+            if (as->pass == 1 && !as->failed)
+                as->macros[as->macro_count++] = macro;
+            return eol < end ? eol + 1 : end;
+        }
+        body = eol < end ? eol + 1 : end;
+    }
+
+    error(as, ".macro %s has no .endm", macro.name);
+    return end;
+}
+
+static void assemble_text(Assembler* as, const char* text, size_t length, int depth) {
+    const char* p = text;
+    const char* end = text + length;
+    char line[ASM_MAX_LINE];
+
+    while (p < end && !as->failed) {
+        const char* eol = memchr(p, '\n', (size_t) (end - p));
+        if (!eol)
+            eol = end;
+        const char* next = eol < end ? eol + 1 : end;
+
+        if (depth == 0)
+            as->line++;
+        if (!read_line(p, (size_t) (eol - p), line))
+            error(as, "line is longer than %d characters", ASM_MAX_LINE - 1);
+        else if (directive_is(line, ".macro"))
+            next = define_macro(as, line, next, end, depth);
+        else
+            assemble_line(as, line, depth);
+
+        p = next;
+    }
+}
+
+bool asm_assemble(Bus* bus, const char* source, AsmResult* result) {
+    // Built by the first call, pthread_once keeps concurrent first calls from racing.
+#ifndef _WIN32
+    pthread_once(&mnemonics_once, &build_mnemonics);
+#else
+    if (!mnemonics_ready) {
+        build_mnemonics();
+        mnemonics_ready = true;
+    }
+#endif
+
+    Assembler as;
+    memset(&as, 0, sizeof(Assembler));
+    memset(result, 0, sizeof(AsmResult));
+    as.bus = bus;
+    as.result = result;
+
+    // The first pass finds the labels, the second emits with all of them known.
+    for (as.pass = 1; as.pass <= 2 && !as.failed; as.pass++) {
+        as.pc = ASM_ORIGIN;
+        as.statement = 0;
+        as.line = 0;
+        as.expansions = 0;
+        assemble_text(&as, source, strlen(source), 0);
+        close_first_section(&as);
+    }
+
+    free(as.symbols);
+    return !as.failed;
+}
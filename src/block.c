@@ -0,0 +1,147 @@
+#include "../include/block.h"
+#include "../include/cpu.h"
+#include "../include/replay.h"
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define BLOCK_REGISTER_MASK 0x00FF
+
+static uint16_t block_sectors(const BlockDevice* block) {
+    size_t sectors = block->size / BLOCK_SECTOR_SIZE;
+    return sectors > 0xFFFF ? 0xFFFF : (uint16_t) sectors;
+}
+
+// Moves the bytes through the bus, so mapped pages and the bus counters see them like cpu accesses,
+// wrapping around the top of memory like the cpu's addresses do. The file is outside input, a read
+// from it goes through the replay as one event and the file is left alone while the replay plays back.
+static void block_transfer(BlockDevice* block, bool to_ram) {
+    size_t offset = (size_t) block->sector * BLOCK_SECTOR_SIZE;
+    size_t length = (size_t) block->count * BLOCK_SECTOR_SIZE;
+    Replay* replay = get_cpu()->replay;
+    bool playing = replay && replay_playing(replay);
+
+    if (block->sector + block->count > block_sectors(block)) {
+        block->status = BLOCK_STATUS_ERROR;
+        return;
+    }
+
+    const uint8_t* input = block->data + offset;
+    if (to_ram && replay)
+        input = replay_input_block(replay, BLOCK_SOURCE_DATA, input, (uint32_t) length);
+
+    uint16_t address = block->dma_address;
+    for (size_t i = 0; i < length; i++, address++) {
+        if (to_ram)
+            bus_write(block->bus, address, input[i]);
+        else {
+            uint8_t data = bus_read(block->bus, address);
+            if (!playing)
+                block->data[offset + i] = data;
+        }
+    }
+
+    block->sector += block->count;
+    block->dma_address = address;
+    block->status = BLOCK_STATUS_OK;
+}
+
+static uint8_t block_read(void* device, uint16_t address) {
+    BlockDevice* block = device;
+
+    switch (address & BLOCK_REGISTER_MASK) {
+    case BLOCK_SECTOR_LOW: return block->sector & 0x00FF;
+    case BLOCK_SECTOR_HIGH: return block->sector >> 8;
+    case BLOCK_DMA_LOW: return block->dma_address & 0x00FF;
+    case BLOCK_DMA_HIGH: return block->dma_address >> 8;
+    case BLOCK_COUNT: return block->count;
+    case BLOCK_COMMAND: return block->status;
+    case BLOCK_SIZE_LOW: return block_sectors(block) & 0x00FF;
+    case BLOCK_SIZE_HIGH: return block_sectors(block) >> 8;
+    default: return 0x00;
+    }
+}
+
+// The registers only change on writes, reading them has no side effects.
+static bool block_quiet(void* device, uint16_t address) {
+    return true;
+}
+
+static void block_write(void* device, uint16_t address, uint8_t data) {
+    BlockDevice* block = device;
+
+    switch (address & BLOCK_REGISTER_MASK) {
+    case BLOCK_SECTOR_LOW: block->sector = (block->sector & 0xFF00) | data; break;
+    case BLOCK_SECTOR_HIGH: block->sector = (block->sector & 0x00FF) | (data << 8); break;
+    case BLOCK_DMA_LOW: block->dma_address = (block->dma_address & 0xFF00) | data; break;
+    case BLOCK_DMA_HIGH: block->dma_address = (block->dma_address & 0x00FF) | (data << 8); break;
+    case BLOCK_COUNT: block->count = data; break;
+    case BLOCK_COMMAND:
+        if (data == BLOCK_READ || data == BLOCK_WRITE)
+            block_transfer(block, data == BLOCK_READ);
+        else
+            block->status = BLOCK_STATUS_ERROR;
+        break;
+    default: break;
+    }
+}
+
+#ifndef _WIN32
+
+bool block_open(BlockDevice* block, Bus* bus, uint16_t base, const char* path) {
+    memset(block, 0, sizeof(BlockDevice));
+
+    int fd = open(path, O_RDWR);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || info.st_size < BLOCK_SECTOR_SIZE) {
+        fprintf(stderr, "Unable to open block device '%s', it needs to hold at least one sector.\n", path);
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+
+    block->size = info.st_size;
+    block->data = mmap(NULL, block->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (block->data == MAP_FAILED) {
+        fprintf(stderr, "Unable to map block device '%s'.\n", path);
+        return false;
+    }
+
+    block->device.read = &block_read;
+    block->device.write = &block_write;
+    block->device.quiet = &block_quiet;
+    block->device.device = block;
+    block->bus = bus;
+
+    bus_map(bus, base, 1, &block->device);
+    return true;
+}
+
+void block_close(BlockDevice* block) {
+    if (!block->data)
+        return;
+
+    msync(block->data, block->size, MS_SYNC);
+    munmap(block->data, block->size);
+    bus_unmap(block->bus, &block->device);
+    block->data = NULL;
+}
+
+#else
+
+bool block_open(BlockDevice* block, Bus* bus, uint16_t base, const char* path) {
+    fprintf(stderr, "Block devices are not supported on this platform.\n");
+    return false;
+}
+
+void block_close(BlockDevice* block) {
+}
+
+#endif
@@ -3,26 +3,79 @@
 #include <string.h>
 #include <stdio.h>
 
-void bus_init(Bus* bus) {
+bool bus_init(Bus* bus) {
     bus->ram = (uint8_t*) malloc(sizeof(uint8_t) * RAM_SIZE);
 
     if (!bus->ram) {
         fprintf(stderr, "Unable to allocate memory for ram.\n");
-        exit(EXIT_FAILURE);
+        return false;
     }
     memset(bus->ram, 0, sizeof(uint8_t) * RAM_SIZE);
+
+    memset(bus->pages, 0, sizeof(bus->pages));
+    bus->read_count = 0;
+    bus->write_count = 0;
+    bus->mmio_count = 0;
+    bus->effect_count = 0;
+    return true;
 }
 
 void bus_free(Bus* bus) {
     free(bus->ram);
 }
 
+void bus_map(Bus* bus, uint16_t address, uint16_t count, const BusDevice* device) {
+    for (uint32_t page = address >> BUS_PAGE_SHIFT; page < BUS_PAGES && count > 0; page++, count--)
+        bus->pages[page] = device;
+}
+
+void bus_unmap(Bus* bus, const BusDevice* device) {
+    for (uint32_t page = 0; page < BUS_PAGES; page++) {
+        if (bus->pages[page] == device)
+            bus->pages[page] = NULL;
+    }
+}
+
+uint64_t bus_next_event(const Bus* bus, uint64_t cycle) {
+    uint64_t next = BUS_NO_EVENT;
+    const BusDevice* previous = NULL;
+
+    for (uint32_t page = 0; page < BUS_PAGES; page++) {
+        const BusDevice* device = bus->pages[page];
+        if (!device || device == previous || !device->next_event)
+            continue;
+
+        uint64_t event = device->next_event(device->device, cycle);
+        if (event < next)
+            next = event;
+        previous = device;
+    }
+    return next;
+}
+
 void bus_write(Bus* bus, uint16_t address, uint8_t data) {
-    if (address_in_range(address))
+    bus->write_count++;
+
+    const BusDevice* device = bus->pages[address >> BUS_PAGE_SHIFT];
+    if (device) {
+        bus->mmio_count++;
+        bus->effect_count++;
+        device->write(device->device, address, data);
+    }
+    else if (address_in_range(address))
         bus->ram[address] = data;
 }
 
 uint8_t bus_read(Bus* bus, uint16_t address) {
+    bus->read_count++;
+
+    const BusDevice* device = bus->pages[address >> BUS_PAGE_SHIFT];
+    if (device) {
+        bus->mmio_count++;
+        if (!device->quiet || !device->quiet(device->device, address))
+            bus->effect_count++;
+        return device->read(device->device, address);
+    }
     if (address_in_range(address))
         return bus->ram[address];
     return 0x00;
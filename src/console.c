@@ -0,0 +1,124 @@
+#include "../include/console.h"
+#include "../include/cpu.h"
+#include "../include/replay.h"
+#include <string.h>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#define read _read
+#define isatty _isatty
+#endif
+
+#define CONSOLE_REGISTER_MASK 0x00FF
+
+void console_flush(Console* console) {
+    if (console->output_length == 0)
+        return;
+
+    fwrite(console->output, 1, console->output_length, console->out);
+    fflush(console->out);
+    console->output_length = 0;
+}
+
+static void console_put(Console* console, uint8_t data) {
+    if (console->muted)
+        return;
+
+    console->output[console->output_length++] = data;
+
+    if (console->output_length == CONSOLE_BUFFER_SIZE || (console->line_buffered && data == '\n'))
+        console_flush(console);
+}
+
+// Refills the input buffer, waiting for the host when wait is set.
+static void console_fill(Console* console, bool wait) {
+    if (console->input_position < console->input_length || console->eof)
+        return;
+
+#ifndef _WIN32
+    struct pollfd descriptor = { console->in, POLLIN, 0 };
+    if (!wait && poll(&descriptor, 1, 0) <= 0)
+        return;
+#else
+    if (!wait)
+        return;
+#endif
+
+    // The guest is about to wait on the host, whatever it printed as a prompt has to be out first.
+    console_flush(console);
+
+    long length = read(console->in, console->input, CONSOLE_BUFFER_SIZE);
+    console->input_position = 0;
+    console->input_length = length > 0 ? length : 0;
+    console->eof = length <= 0;
+}
+
+static uint8_t console_get(Console* console) {
+    console_fill(console, true);
+
+    if (console->input_position < console->input_length)
+        return console->input[console->input_position++];
+    return 0x00;
+}
+
+static uint8_t console_status(Console* console) {
+    console_fill(console, false);
+
+    uint8_t status = 0x00;
+    if (console->input_position < console->input_length)
+        status |= CONSOLE_STATUS_READY;
+    if (console->eof)
+        status |= CONSOLE_STATUS_EOF;
+    return status;
+}
+
+// Input comes from the outside world, so it goes through the replay and is not read at all on playback.
+static uint8_t console_read(void* device, uint16_t address) {
+    Console* console = device;
+    Replay* replay = get_cpu()->replay;
+    bool playing = replay && replay_playing(replay);
+
+    switch (address & CONSOLE_REGISTER_MASK) {
+    case CONSOLE_IN: {
+        uint8_t data = playing ? 0x00 : console_get(console);
+        return replay ? replay_input(replay, CONSOLE_SOURCE_IN, data) : data;
+    }
+    case CONSOLE_STATUS: {
+        uint8_t status = playing ? 0x00 : console_status(console);
+        return replay ? replay_input(replay, CONSOLE_SOURCE_STATUS, status) : status;
+    }
+    default:
+        return 0x00;
+    }
+}
+
+static void console_write(void* device, uint16_t address, uint8_t data) {
+    Console* console = device;
+
+    switch (address & CONSOLE_REGISTER_MASK) {
+    case CONSOLE_OUT: console_put(console, data); break;
+    case CONSOLE_FLUSH: console_flush(console); break;
+    default: break;
+    }
+}
+
+void console_init(Console* console, Bus* bus, uint16_t base) {
+    memset(console, 0, sizeof(Console));
+
+    console->device.read = &console_read;
+    console->device.write = &console_write;
+    console->device.device = console;
+    console->out = stdout;
+    console->in = 0;
+    console->line_buffered = isatty(fileno(stdout));
+
+    bus_map(bus, base, 1, &console->device);
+}
+
+void console_free(Console* console, Bus* bus) {
+    console_flush(console);
+    bus_unmap(bus, &console->device);
+}
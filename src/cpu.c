@@ -1,4 +1,5 @@
 #include "../include/cpu.h"
+#include "../include/replay.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -11,10 +12,104 @@
 #define LOW_8_BIT_MASK 0x00FF
 #define HIGH_8_BIT_MASK 0xFF00
 
-static Cpu* cpu;
-
-void cpu_init() {
-    cpu = malloc(sizeof(Cpu));
+// The cpu the handlers work on. Every thread selects its own, so several cpus can run at once.
+static _Thread_local Cpu* cpu;
+
+// The variant entries after the base rows replace some of them on purpose, which -Wextra reports
+// as overridden initializers.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Woverride-init"
+const Instruction instructions[256] = {
+    //               0                               1                              2                                 3                             4                             5                             6                               7                             8                               9                               A                              B                              C                               D                             E                             F                                                       
+/* 0 */ { "BRK", &MODE_IMP, &BRK, 7 }, { "ORA", &MODE_INX, &ORA, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ORA", &MODE_ZP,  &ORA, 3 }, { "ASL", &MODE_ZP,  &ASL, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "PHP", &MODE_IMP, &PHP, 3 }, { "ORA", &MODE_IMM, &ORA, 2 }, { "ASL", &MODE_ACC, &ASL, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ORA", &MODE_ABS, &ORA, 4 }, { "ASL", &MODE_ABS, &ASL, 6 }, { "ILL", &MODE_IMP, &ILL, 7 },
+/* 1 */ { "BPL", &MODE_REL, &BPL, 2 }, { "ORA", &MODE_INY, &ORA, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ORA", &MODE_ZPX, &ORA, 4 }, { "ASL", &MODE_ZPX, &ASL, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CLC", &MODE_IMP, &CLC, 2 }, { "ORA", &MODE_ABY, &ORA, 4 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ORA", &MODE_ABX, &ORA, 4 }, { "ASL", &MODE_ABX, &ASL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 },
+/* 2 */ { "JSR", &MODE_ABS, &JSR, 6 }, { "AND", &MODE_INX, &AND, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "BIT", &MODE_ZP,  &BIT, 3 }, { "AND", &MODE_ZP,  &AND, 3 }, { "ROL", &MODE_ZP,  &ROL, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "PLP", &MODE_IMP, &PLP, 4 }, { "AND", &MODE_IMM, &AND, 2 }, { "ROL", &MODE_ACC, &ROL, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "BIT", &MODE_ABS, &BIT, 4 }, { "AND", &MODE_ABS, &AND, 4 }, { "ROL", &MODE_ABS, &ROL, 6 }, { "ILL", &MODE_IMP, &ILL, 7 },
+/* 3 */ { "BMI", &MODE_REL, &BMI, 2 }, { "AND", &MODE_INY, &AND, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "AND", &MODE_ZPX, &AND, 4 }, { "ROL", &MODE_ZPX, &ROL, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "SEC", &MODE_IMP, &SEC, 2 }, { "AND", &MODE_ABY, &AND, 4 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "AND", &MODE_ABX, &AND, 4 }, { "ROL", &MODE_ABX, &ROL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 },
+/* 4 */ { "RTI", &MODE_IMP, &RTI, 6 }, { "EOR", &MODE_INX, &EOR, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "EOR", &MODE_ZP,  &EOR, 3 }, { "LSR", &MODE_ZP,  &LSR, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "PHA", &MODE_IMP, &PHA, 3 }, { "EOR", &MODE_IMM, &EOR, 2 }, { "LSR", &MODE_ACC, &LSR, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "JMP", &MODE_ABS, &JMP, 3 }, { "EOR", &MODE_ABS, &EOR, 4 }, { "LSR", &MODE_ABS, &LSR, 6 }, { "ILL", &MODE_IMP, &ILL, 7 },
+/* 5 */ { "BVC", &MODE_REL, &BVC, 2 }, { "EOR", &MODE_INY, &EOR, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "EOR", &MODE_ZPX, &EOR, 4 }, { "LSR", &MODE_ZPX, &LSR, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CLI", &MODE_IMP, &CLI, 2 }, { "EOR", &MODE_ABY, &EOR, 4 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "EOR", &MODE_ABX, &EOR, 4 }, { "LSR", &MODE_ABX, &LSR, 7 }, { "ILL", &MODE_IMP, &ILL, 7 },
+/* 6 */ { "RTS", &MODE_IMP, &RTS, 6 }, { "ADC", &MODE_INX, &ADC, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ADC", &MODE_ZP,  &ADC, 3 }, { "ROR", &MODE_ZP,  &ROR, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "PLA", &MODE_IMP, &PLA, 4 }, { "ADC", &MODE_IMM, &ADC, 2 }, { "ROR", &MODE_ACC, &ROR, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "JMP", &MODE_IND, &JMP, 5 }, { "ADC", &MODE_ABS, &ADC, 4 }, { "ROR", &MODE_ABS, &ROR, 6 }, { "ILL", &MODE_IMP, &ILL, 7 },
+/* 7 */ { "BVS", &MODE_REL, &BVS, 2 }, { "ADC", &MODE_INY, &ADC, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ADC", &MODE_ZPX, &ADC, 4 }, { "ROR", &MODE_ZPX, &ROR, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "SEI", &MODE_IMP, &SEI, 2 }, { "ADC", &MODE_ABY, &ADC, 4 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ADC", &MODE_ABX, &ADC, 4 }, { "ROR", &MODE_ABX, &ROR, 7 }, { "ILL", &MODE_IMP, &ILL, 7 },
+/* 8 */ { "ILL", &MODE_IMP, &ILL, 7 }, { "STA", &MODE_INX, &STA, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "STY", &MODE_ZP,  &STY, 3 }, { "STA", &MODE_ZP,  &STA, 3 }, { "STX", &MODE_ZP,  &STX, 3 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "DEY", &MODE_IMP, &DEY, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "TXA", &MODE_IMP, &TXA, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "STY", &MODE_ABS, &STY, 4 }, { "STA", &MODE_ABS, &STA, 4 }, { "STX", &MODE_ABS, &STX, 4 }, { "ILL", &MODE_IMP, &ILL, 7 },
+/* 9 */ { "BCC", &MODE_REL, &BCC, 2 }, { "STA", &MODE_INY, &STA, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "STY", &MODE_ZPX, &STY, 4 }, { "STA", &MODE_ZPX, &STA, 4 }, { "STX", &MODE_ZPY, &STX, 4 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "TYA", &MODE_IMP, &TYA, 2 }, { "STA", &MODE_ABY, &STA, 5 }, { "TXS", &MODE_IMP, &TXS, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "STA", &MODE_ABX, &STA, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 },
+/* A */ { "LDY", &MODE_IMM, &LDY, 2 }, { "LDA", &MODE_INX, &LDA, 6 }, { "LDX", &MODE_IMM, &LDX, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "LDY", &MODE_ZP,  &LDY, 3 }, { "LDA", &MODE_ZP,  &LDA, 3 }, { "LDX", &MODE_ZP,  &LDX, 3 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "TAY", &MODE_IMP, &TAY, 2 }, { "LDA", &MODE_IMM, &LDA, 2 }, { "TAX", &MODE_IMP, &TAX, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "LDY", &MODE_ABS, &LDY, 4 }, { "LDA", &MODE_ABS, &LDA, 4 }, { "LDX", &MODE_ABS, &LDX, 4 }, { "ILL", &MODE_IMP, &ILL, 7 },
+/* B */ { "BCS", &MODE_REL, &BCS, 2 }, { "LDA", &MODE_INY, &LDA, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "LDY", &MODE_ZPX, &LDY, 4 }, { "LDA", &MODE_ZPX, &LDA, 4 }, { "LDX", &MODE_ZPY, &LDX, 4 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CLV", &MODE_IMP, &CLV, 2 }, { "LDA", &MODE_ABY, &LDA, 4 }, { "TSX", &MODE_IMP, &TSX, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "LDY", &MODE_ABX, &LDY, 4 }, { "LDA", &MODE_ABX, &LDA, 4 }, { "LDX", &MODE_ABY, &LDX, 4 }, { "ILL", &MODE_IMP, &ILL, 7 },
+/* C */ { "CPY", &MODE_IMM, &CPY, 2 }, { "CMP", &MODE_INX, &CMP, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CPY", &MODE_ZP,  &CPY, 3 }, { "CMP", &MODE_ZP,  &CMP, 3 }, { "DEC", &MODE_ZP,  &DEC, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "INY", &MODE_IMP, &INY, 2 }, { "CMP", &MODE_IMM, &CMP, 2 }, { "DEX", &MODE_IMP, &DEX, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CPY", &MODE_ABS, &CPY, 4 }, { "CMP", &MODE_ABS, &CMP, 4 }, { "DEC", &MODE_ABS, &DEC, 6 }, { "ILL", &MODE_IMP, &ILL, 7 },
+/* D */ { "BNE", &MODE_REL, &BNE, 2 }, { "CMP", &MODE_INY, &CMP, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CMP", &MODE_ZPX, &CMP, 4 }, { "DEC", &MODE_ZPX, &DEC, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CLD", &MODE_IMP, &CLD, 2 }, { "CMP", &MODE_ABY, &CMP, 4 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CMP", &MODE_ABX, &CMP, 4 }, { "DEC", &MODE_ABX, &DEC, 7 }, { "ILL", &MODE_IMP, &ILL, 7 },
+/* E */ { "CPX", &MODE_IMM, &CPX, 2 }, { "SBC", &MODE_INX, &SBC, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CPX", &MODE_ZP,  &CPX, 3 }, { "SBC", &MODE_ZP,  &SBC, 3 }, { "INC", &MODE_ZP,  &INC, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "INX", &MODE_IMP, &INX, 2 }, { "SBC", &MODE_IMM, &SBC, 2 }, { "NOP", &MODE_IMP, &NOP, 2 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "CPX", &MODE_ABS, &CPX, 4 }, { "SBC", &MODE_ABS, &SBC, 4 }, { "INC", &MODE_ABS, &INC, 6 }, { "ILL", &MODE_IMP, &ILL, 7 },
+/* F */ { "BEQ", &MODE_REL, &BEQ, 2 }, { "SBC", &MODE_INY, &SBC, 5 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "SBC", &MODE_ZPX, &SBC, 4 }, { "INC", &MODE_ZPX, &INC, 6 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "SED", &MODE_IMP, &SED, 2 }, { "SBC", &MODE_ABY, &SBC, 4 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "ILL", &MODE_IMP, &ILL, 7 }, { "SBC", &MODE_ABX, &SBC, 4 }, { "INC", &MODE_ABX, &INC, 7 }, { "ILL", &MODE_IMP, &ILL, 7 },
+
+#if CPU_VARIANT == CPU_65C02
+    // The 65C02 additions. Later designators replace the NMOS entries above.
+    [0x80] = { "BRA", &MODE_REL, &BRA, 3 },
+    [0xDA] = { "PHX", &MODE_IMP, &PHX, 3 }, [0x5A] = { "PHY", &MODE_IMP, &PHY, 3 },
+    [0xFA] = { "PLX", &MODE_IMP, &PLX, 4 }, [0x7A] = { "PLY", &MODE_IMP, &PLY, 4 },
+    [0x64] = { "STZ", &MODE_ZP,  &STZ, 3 }, [0x74] = { "STZ", &MODE_ZPX, &STZ, 4 }, [0x9C] = { "STZ", &MODE_ABS, &STZ, 4 }, [0x9E] = { "STZ", &MODE_ABX, &STZ, 5 },
+    [0x04] = { "TSB", &MODE_ZP,  &TSB, 5 }, [0x0C] = { "TSB", &MODE_ABS, &TSB, 6 },
+    [0x14] = { "TRB", &MODE_ZP,  &TRB, 5 }, [0x1C] = { "TRB", &MODE_ABS, &TRB, 6 },
+    [0x1A] = { "INC", &MODE_ACC, &INC, 2 }, [0x3A] = { "DEC", &MODE_ACC, &DEC, 2 },
+    [0x89] = { "BIT", &MODE_IMM, &BIT, 2 }, [0x34] = { "BIT", &MODE_ZPX, &BIT, 4 }, [0x3C] = { "BIT", &MODE_ABX, &BIT, 4 },
+    [0x12] = { "ORA", &MODE_ZPI, &ORA, 5 }, [0x32] = { "AND", &MODE_ZPI, &AND, 5 }, [0x52] = { "EOR", &MODE_ZPI, &EOR, 5 }, [0x72] = { "ADC", &MODE_ZPI, &ADC, 5 },
+    [0x92] = { "STA", &MODE_ZPI, &STA, 5 }, [0xB2] = { "LDA", &MODE_ZPI, &LDA, 5 }, [0xD2] = { "CMP", &MODE_ZPI, &CMP, 5 }, [0xF2] = { "SBC", &MODE_ZPI, &SBC, 5 },
+    [0x6C] = { "JMP", &MODE_IND, &JMP, 6 }, [0x7C] = { "JMP", &MODE_IAX, &JMP, 6 },
+
+    // Every other undefined opcode is a NOP that still consumes its operand bytes.
+    [0x02] = { "NOP", &MODE_IMM, &NOP, 2 }, [0x22] = { "NOP", &MODE_IMM, &NOP, 2 }, [0x42] = { "NOP", &MODE_IMM, &NOP, 2 }, [0x62] = { "NOP", &MODE_IMM, &NOP, 2 },
+    [0x82] = { "NOP", &MODE_IMM, &NOP, 2 }, [0xC2] = { "NOP", &MODE_IMM, &NOP, 2 }, [0xE2] = { "NOP", &MODE_IMM, &NOP, 2 },
+    [0x44] = { "NOP", &MODE_ZP,  &NOP, 3 }, [0x54] = { "NOP", &MODE_ZPX, &NOP, 4 }, [0xD4] = { "NOP", &MODE_ZPX, &NOP, 4 }, [0xF4] = { "NOP", &MODE_ZPX, &NOP, 4 },
+    [0x5C] = { "NOP", &MODE_ABS, &NOP, 8 }, [0xDC] = { "NOP", &MODE_ABS, &NOP, 4 }, [0xFC] = { "NOP", &MODE_ABS, &NOP, 4 },
+    [0x03] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x13] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x23] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x33] = { "NOP", &MODE_IMP, &NOP, 1 },
+    [0x43] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x53] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x63] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x73] = { "NOP", &MODE_IMP, &NOP, 1 },
+    [0x83] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x93] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xA3] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xB3] = { "NOP", &MODE_IMP, &NOP, 1 },
+    [0xC3] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xD3] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xE3] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xF3] = { "NOP", &MODE_IMP, &NOP, 1 },
+    [0x07] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x17] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x27] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x37] = { "NOP", &MODE_IMP, &NOP, 1 },
+    [0x47] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x57] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x67] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x77] = { "NOP", &MODE_IMP, &NOP, 1 },
+    [0x87] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x97] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xA7] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xB7] = { "NOP", &MODE_IMP, &NOP, 1 },
+    [0xC7] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xD7] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xE7] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xF7] = { "NOP", &MODE_IMP, &NOP, 1 },
+    [0x0B] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x1B] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x2B] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x3B] = { "NOP", &MODE_IMP, &NOP, 1 },
+    [0x4B] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x5B] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x6B] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x7B] = { "NOP", &MODE_IMP, &NOP, 1 },
+    [0x8B] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x9B] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xAB] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xBB] = { "NOP", &MODE_IMP, &NOP, 1 },
+    [0xCB] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xDB] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xEB] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xFB] = { "NOP", &MODE_IMP, &NOP, 1 },
+    [0x0F] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x1F] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x2F] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x3F] = { "NOP", &MODE_IMP, &NOP, 1 },
+    [0x4F] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x5F] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x6F] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x7F] = { "NOP", &MODE_IMP, &NOP, 1 },
+    [0x8F] = { "NOP", &MODE_IMP, &NOP, 1 }, [0x9F] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xAF] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xBF] = { "NOP", &MODE_IMP, &NOP, 1 },
+    [0xCF] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xDF] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xEF] = { "NOP", &MODE_IMP, &NOP, 1 }, [0xFF] = { "NOP", &MODE_IMP, &NOP, 1 },
+#else
+    // The undocumented NMOS opcodes that behave the same on every part.
+    [0x07] = { "SLO", &MODE_ZP,  &SLO, 5 }, [0x17] = { "SLO", &MODE_ZPX, &SLO, 6 }, [0x0F] = { "SLO", &MODE_ABS, &SLO, 6 }, [0x1F] = { "SLO", &MODE_ABX, &SLO, 7 }, [0x1B] = { "SLO", &MODE_ABY, &SLO, 7 }, [0x03] = { "SLO", &MODE_INX, &SLO, 8 }, [0x13] = { "SLO", &MODE_INY, &SLO, 8 },
+    [0x27] = { "RLA", &MODE_ZP,  &RLA, 5 }, [0x37] = { "RLA", &MODE_ZPX, &RLA, 6 }, [0x2F] = { "RLA", &MODE_ABS, &RLA, 6 }, [0x3F] = { "RLA", &MODE_ABX, &RLA, 7 }, [0x3B] = { "RLA", &MODE_ABY, &RLA, 7 }, [0x23] = { "RLA", &MODE_INX, &RLA, 8 }, [0x33] = { "RLA", &MODE_INY, &RLA, 8 },
+    [0x47] = { "SRE", &MODE_ZP,  &SRE, 5 }, [0x57] = { "SRE", &MODE_ZPX, &SRE, 6 }, [0x4F] = { "SRE", &MODE_ABS, &SRE, 6 }, [0x5F] = { "SRE", &MODE_ABX, &SRE, 7 }, [0x5B] = { "SRE", &MODE_ABY, &SRE, 7 }, [0x43] = { "SRE", &MODE_INX, &SRE, 8 }, [0x53] = { "SRE", &MODE_INY, &SRE, 8 },
+    [0x67] = { "RRA", &MODE_ZP,  &RRA, 5 }, [0x77] = { "RRA", &MODE_ZPX, &RRA, 6 }, [0x6F] = { "RRA", &MODE_ABS, &RRA, 6 }, [0x7F] = { "RRA", &MODE_ABX, &RRA, 7 }, [0x7B] = { "RRA", &MODE_ABY, &RRA, 7 }, [0x63] = { "RRA", &MODE_INX, &RRA, 8 }, [0x73] = { "RRA", &MODE_INY, &RRA, 8 },
+    [0xC7] = { "DCP", &MODE_ZP,  &DCP, 5 }, [0xD7] = { "DCP", &MODE_ZPX, &DCP, 6 }, [0xCF] = { "DCP", &MODE_ABS, &DCP, 6 }, [0xDF] = { "DCP", &MODE_ABX, &DCP, 7 }, [0xDB] = { "DCP", &MODE_ABY, &DCP, 7 }, [0xC3] = { "DCP", &MODE_INX, &DCP, 8 }, [0xD3] = { "DCP", &MODE_INY, &DCP, 8 },
+    [0xE7] = { "ISC", &MODE_ZP,  &ISC, 5 }, [0xF7] = { "ISC", &MODE_ZPX, &ISC, 6 }, [0xEF] = { "ISC", &MODE_ABS, &ISC, 6 }, [0xFF] = { "ISC", &MODE_ABX, &ISC, 7 }, [0xFB] = { "ISC", &MODE_ABY, &ISC, 7 }, [0xE3] = { "ISC", &MODE_INX, &ISC, 8 }, [0xF3] = { "ISC", &MODE_INY, &ISC, 8 },
+    [0xA7] = { "LAX", &MODE_ZP,  &LAX, 3 }, [0xB7] = { "LAX", &MODE_ZPY, &LAX, 4 }, [0xAF] = { "LAX", &MODE_ABS, &LAX, 4 }, [0xBF] = { "LAX", &MODE_ABY, &LAX, 4 }, [0xA3] = { "LAX", &MODE_INX, &LAX, 6 }, [0xB3] = { "LAX", &MODE_INY, &LAX, 5 },
+    [0x87] = { "SAX", &MODE_ZP,  &SAX, 3 }, [0x97] = { "SAX", &MODE_ZPY, &SAX, 4 }, [0x8F] = { "SAX", &MODE_ABS, &SAX, 4 }, [0x83] = { "SAX", &MODE_INX, &SAX, 6 },
+    [0x0B] = { "ANC", &MODE_IMM, &ANC, 2 }, [0x2B] = { "ANC", &MODE_IMM, &ANC, 2 }, [0x4B] = { "ALR", &MODE_IMM, &ALR, 2 }, [0x6B] = { "ARR", &MODE_IMM, &ARR, 2 }, [0xCB] = { "SBX", &MODE_IMM, &SBX, 2 }, [0xEB] = { "SBC", &MODE_IMM, &SBC, 2 }, [0xBB] = { "LAS", &MODE_ABY, &LAS, 4 },
+
+    // ANE, LXA, SHA, SHX, SHY and TAS depend on the chip and stay illegal, but take their operands
+    // so the pc stays on the instruction stream.
+    [0x8B] = { "ANE", &MODE_IMM, &ILL, 2 }, [0xAB] = { "LXA", &MODE_IMM, &ILL, 2 }, [0x93] = { "SHA", &MODE_INY, &ILL, 6 }, [0x9F] = { "SHA", &MODE_ABY, &ILL, 5 },
+    [0x9B] = { "TAS", &MODE_ABY, &ILL, 5 }, [0x9C] = { "SHY", &MODE_ABX, &ILL, 5 }, [0x9E] = { "SHX", &MODE_ABY, &ILL, 5 },
+
+    // Undocumented NOPs still read their operand bytes, the JAMs lock the cpu up.
+    [0x1A] = { "NOP", &MODE_IMP, &NOP, 2 }, [0x3A] = { "NOP", &MODE_IMP, &NOP, 2 }, [0x5A] = { "NOP", &MODE_IMP, &NOP, 2 }, [0x7A] = { "NOP", &MODE_IMP, &NOP, 2 }, [0xDA] = { "NOP", &MODE_IMP, &NOP, 2 }, [0xFA] = { "NOP", &MODE_IMP, &NOP, 2 },
+    [0x80] = { "NOP", &MODE_IMM, &NOP, 2 }, [0x82] = { "NOP", &MODE_IMM, &NOP, 2 }, [0x89] = { "NOP", &MODE_IMM, &NOP, 2 }, [0xC2] = { "NOP", &MODE_IMM, &NOP, 2 }, [0xE2] = { "NOP", &MODE_IMM, &NOP, 2 }, [0x04] = { "NOP", &MODE_ZP,  &NOP, 3 },
+    [0x44] = { "NOP", &MODE_ZP,  &NOP, 3 }, [0x64] = { "NOP", &MODE_ZP,  &NOP, 3 }, [0x14] = { "NOP", &MODE_ZPX, &NOP, 4 }, [0x34] = { "NOP", &MODE_ZPX, &NOP, 4 }, [0x54] = { "NOP", &MODE_ZPX, &NOP, 4 }, [0x74] = { "NOP", &MODE_ZPX, &NOP, 4 },
+    [0xD4] = { "NOP", &MODE_ZPX, &NOP, 4 }, [0xF4] = { "NOP", &MODE_ZPX, &NOP, 4 }, [0x0C] = { "NOP", &MODE_ABS, &NOP, 4 }, [0x1C] = { "NOP", &MODE_ABX, &NOP, 4 }, [0x3C] = { "NOP", &MODE_ABX, &NOP, 4 }, [0x5C] = { "NOP", &MODE_ABX, &NOP, 4 },
+    [0x7C] = { "NOP", &MODE_ABX, &NOP, 4 }, [0xDC] = { "NOP", &MODE_ABX, &NOP, 4 }, [0xFC] = { "NOP", &MODE_ABX, &NOP, 4 },
+    [0x02] = { "JAM", &MODE_IMP, &JAM, 2 }, [0x12] = { "JAM", &MODE_IMP, &JAM, 2 }, [0x22] = { "JAM", &MODE_IMP, &JAM, 2 }, [0x32] = { "JAM", &MODE_IMP, &JAM, 2 }, [0x42] = { "JAM", &MODE_IMP, &JAM, 2 }, [0x52] = { "JAM", &MODE_IMP, &JAM, 2 },
+    [0x62] = { "JAM", &MODE_IMP, &JAM, 2 }, [0x72] = { "JAM", &MODE_IMP, &JAM, 2 }, [0x92] = { "JAM", &MODE_IMP, &JAM, 2 }, [0xB2] = { "JAM", &MODE_IMP, &JAM, 2 }, [0xD2] = { "JAM", &MODE_IMP, &JAM, 2 }, [0xF2] = { "JAM", &MODE_IMP, &JAM, 2 },
+#endif
+};
+#pragma GCC diagnostic pop
+
+// Allocates a new cpu and selects it.
+bool cpu_init() {
+    Cpu* created = malloc(sizeof(Cpu));
+    if (!created) {
+        fprintf(stderr, "Unable to allocate memory for the cpu.\n");
+        return false;
+    }
+    cpu = created;
     memset(cpu, 0, sizeof(Cpu));
 
     cpu->a = 0x00;
@@ -28,6 +123,14 @@ void cpu_init() {
     cpu->cycles = 0x00;
     cpu->fetched_address = 0x00;
     cpu->fetched_data = 0x00;
+    atomic_init(&cpu->interrupt_lines, 0);
+    cpu->instruction_count = 0;
+    cpu->interrupt_count = 0;
+    cpu->illegal_count = 0;
+    cpu->halted = false;
+    cpu->replay = NULL;
+    cpu->undocumented = UNDOCUMENTED_EXECUTE;
+    return true;
 }
 
 void cpu_reset() {
@@ -44,16 +147,23 @@ void cpu_reset() {
     cpu->cycles += 8;
     cpu->fetched_address = 0x00;
     cpu->fetched_data = 0x00;
+    cpu->halted = false;
 }
 
+// Frees the selected cpu, nothing is selected afterwards.
 void cpu_free() {
-    cpu->bus = NULL;
+    free(cpu);
+    cpu = NULL;
 }
 
 Cpu* get_cpu() {
     return cpu;
 }
 
+void cpu_select(Cpu* target) {
+    cpu = target;
+}
+
 void cpu_connect_bus(Bus* bus) {
     if (!bus) {
         fprintf(stderr, "Cpu cannot connect to a NULL bus.\n");
@@ -62,17 +172,42 @@ void cpu_connect_bus(Bus* bus) {
     cpu->bus = bus;
 }
 
+// Decides on the lines as sampled, so the cpu acts on exactly the value a replay logged.
+static bool lines_pending(uint32_t lines) {
+    return (lines & NMI_PENDING) || ((lines & IRQ_LINES_MASK) && get_flag(I) == 0);
+}
+
 bool cpu_clock() {
     bool executed = false;
 
     if (cpu->cycles == 0) {
-        cpu->opcode = cpu_read(cpu->pc++);
-        cpu->cycles += instructions[cpu->opcode].cycles;
-
-        uint8_t additional_cycles = instructions[cpu->opcode].address_mode();
-        additional_cycles += instructions[cpu->opcode].opcode();
-
-        executed = true;
+        // Interrupts are only sampled between instructions. Guests that never raise one pay for a single load and test.
+        uint32_t lines = atomic_load_explicit(&cpu->interrupt_lines, memory_order_relaxed);
+
+        // The lines are recorded or replayed where the cpu observes them, which keeps a replay exact.
+        if (cpu->replay)
+            lines = replay_interrupts(cpu->replay, lines);
+
+        if ((lines & INTERRUPT_PENDING_MASK) && lines_pending(lines)) {
+            if (lines & NMI_PENDING)
+                nmi();
+            else
+                irq();
+        }
+        else {
+            cpu->opcode = cpu_read(cpu->pc++);
+            cpu->cycles += instructions[cpu->opcode].cycles;
+
+            uint8_t additional_cycles = instructions[cpu->opcode].address_mode();
+            // Only a cpu with a policy other than execute pays for telling undocumented opcodes apart.
+            if (cpu->undocumented != UNDOCUMENTED_EXECUTE && cpu_undocumented(cpu->opcode))
+                additional_cycles += cpu_run_undocumented();
+            else
+                additional_cycles += instructions[cpu->opcode].opcode();
+
+            cpu->instruction_count++;
+            executed = true;
+        }
     }
 
     cpu->cycles--;
@@ -80,38 +215,126 @@ bool cpu_clock() {
     return executed;
 }
 
+// Pushes the pc and status and continues at the handler the vector points to. Shared by BRK,
+// which is the only one to push B set.
+static void enter_handler(uint16_t vector, bool brk) {
+    cpu_write(STACK_PTR_ADR + cpu->sp, (cpu->pc >> 8) & 0x00FF);
+    cpu->sp--;
+    cpu_write(STACK_PTR_ADR + cpu->sp, (cpu->pc & 0x00FF));
+    cpu->sp--;
+
+    cpu_write(STACK_PTR_ADR + cpu->sp, brk ? (cpu->status | B | U) : ((cpu->status & ~B) | U));
+    cpu->sp--;
+
+    set_flag(I, true);
+#if CPU_VARIANT == CPU_65C02
+    set_flag(D, false);
+#endif
+
+    cpu->pc = (cpu_read(vector + 1) << 8) | cpu_read(vector);
+}
+
+static void interrupt(uint16_t vector) {
+    enter_handler(vector, false);
+    cpu->cycles = 7;
+    cpu->interrupt_count++;
+}
+
 void irq() {
-    if (get_flag(I) == 0) {
-        set_flag(I, true);
-        set_flag(B, false);
+    if (get_flag(I) == 0)
+        interrupt(IRQ_VECTOR);
+}
+
+void nmi() {
+    atomic_fetch_and_explicit(&cpu->interrupt_lines, ~NMI_PENDING, memory_order_relaxed);
+    interrupt(NMI_VECTOR);
+}
 
-        cpu_write(STACK_PTR_ADR + cpu->sp, (cpu->pc >> 8) & 0x00FF);
-        cpu->sp--;
-        cpu_write(STACK_PTR_ADR + cpu->sp, (cpu->pc & 0x00FF));
-        cpu->sp--;
+bool interrupt_pending() {
+    return lines_pending(atomic_load_explicit(&cpu->interrupt_lines, memory_order_relaxed));
+}
 
-        cpu_write(STACK_PTR_ADR + cpu->sp, cpu->status);
-        cpu->sp--;
+void cpu_set_irq(Cpu* target, uint32_t source, bool asserted) {
+    if (asserted)
+        atomic_fetch_or_explicit(&target->interrupt_lines, source & IRQ_LINES_MASK, memory_order_release);
+    else
+        atomic_fetch_and_explicit(&target->interrupt_lines, ~(source & IRQ_LINES_MASK), memory_order_release);
+}
 
-        cpu->fetched_address = (cpu_read(IRQ_VECTOR + 1) << 8) | cpu_read(IRQ_VECTOR);
-        cpu->cycles = 7;
+void cpu_set_nmi(Cpu* target, bool asserted) {
+    if (!asserted) {
+        atomic_fetch_and_explicit(&target->interrupt_lines, ~NMI_LINE, memory_order_release);
+        return;
     }
+
+    uint32_t old = atomic_fetch_or_explicit(&target->interrupt_lines, NMI_LINE, memory_order_release);
+    if (!(old & NMI_LINE))
+        atomic_fetch_or_explicit(&target->interrupt_lines, NMI_PENDING, memory_order_release);
 }
 
-void nmi() {
-    set_flag(I, true);
-    set_flag(B, false);
+void cpu_pulse_nmi(Cpu* target) {
+    cpu_set_nmi(target, true);
+    cpu_set_nmi(target, false);
+}
 
-    cpu_write(STACK_PTR_ADR + cpu->sp, (cpu->pc >> 8) & 0x00FF);
-    cpu->sp--;
-    cpu_write(STACK_PTR_ADR + cpu->sp, (cpu->pc & 0x00FF));
-    cpu->sp--;
+#if CPU_VARIANT != CPU_65C02
+static bool undocumented(uint8_t opcode) {
+    Opcode handler = instructions[opcode].opcode;
 
-    cpu_write(STACK_PTR_ADR + cpu->sp, cpu->status);
-    cpu->sp--;
+    return handler == &ILL || handler == &JAM || handler == &LAX || handler == &SAX || handler == &SLO
+        || handler == &RLA || handler == &SRE || handler == &RRA || handler == &DCP || handler == &ISC
+        || handler == &ANC || handler == &ALR || handler == &ARR || handler == &SBX || handler == &LAS
+        || (handler == &NOP && opcode != 0xEA) || opcode == 0xEB;
+}
 
-    cpu->fetched_address = (cpu_read(IRQ_VECTOR + 1) << 8) | cpu_read(IRQ_VECTOR);
-    cpu->cycles = 8;
+// Bytes taken by the current instruction, used to find its address once the operand was read.
+static uint16_t instruction_length() {
+    AddressMode mode = instructions[cpu->opcode].address_mode;
+
+    if (mode == &MODE_IMP || mode == &MODE_ACC)
+        return 1;
+    if (mode == &MODE_ABS || mode == &MODE_ABX || mode == &MODE_ABY || mode == &MODE_IND)
+        return 3;
+    return 2;
+}
+#endif
+
+void cpu_set_undocumented_policy(UndocumentedPolicy policy) {
+    cpu->undocumented = policy;
+    memset(cpu->undocumented_seen, 0, sizeof(cpu->undocumented_seen));
+}
+
+bool cpu_undocumented(uint8_t opcode) {
+#if CPU_VARIANT != CPU_65C02
+    return undocumented(opcode);
+#else
+    return false;
+#endif
+}
+
+uint8_t cpu_run_undocumented() {
+#if CPU_VARIANT != CPU_65C02
+    switch (cpu->undocumented) {
+    case UNDOCUMENTED_EXECUTE:
+        break;
+    case UNDOCUMENTED_LOG: {
+        uint32_t bit = 1u << (cpu->opcode & 0x1F);
+        if (!(cpu->undocumented_seen[cpu->opcode >> 5] & bit)) {
+            cpu->undocumented_seen[cpu->opcode >> 5] |= bit;
+            fprintf(stderr, "Undocumented opcode $%02X (%s) at $%04X.\n", cpu->opcode, instructions[cpu->opcode].name,
+                (uint16_t)(cpu->pc - instruction_length()));
+        }
+        break;
+    }
+    case UNDOCUMENTED_TRAP:
+        // Halts with the pc on the opcode, so the run loop can report where it stopped.
+        cpu->illegal_count++;
+        cpu->pc -= instruction_length();
+        cpu->halted = true;
+        return 0x00;
+    }
+#endif
+    return instructions[cpu->opcode].opcode();
 }
 
 uint8_t cpu_read(uint16_t address) {
@@ -213,12 +436,12 @@ uint8_t MODE_ZPY() {
     return 0x00;
 }
 
-// The next byte is added to the current program counter.
+// The next byte, signed, is added to the program counter past it.
 uint8_t MODE_REL() {
-    cpu->fetched_address = cpu_read(cpu->pc++);
-    cpu->fetched_address &= LOW_8_BIT_MASK;
+    int8_t offset = (int8_t) cpu_read(cpu->pc++);
 
-    cpu->fetched_address = cpu->pc + cpu->fetched_address;
+    cpu->fetched_address = cpu->pc + offset;
+    return 0x00;
 }
 
 // The next two bytes are pointers to the address where the data is.
@@ -227,7 +450,13 @@ uint8_t MODE_IND() {
     uint8_t high_byte = cpu_read(cpu->pc++);
 
     uint16_t addr = ((high_byte << 8) | low_byte);
+#if CPU_VARIANT == CPU_65C02
     cpu->fetched_address = (cpu_read(addr + 1) << 8) | cpu_read(addr);
+#else
+    // The NMOS parts do not carry into the pointer's high byte, JMP ($xxFF) reads its high byte from $xx00.
+    uint16_t high_addr = (addr & HIGH_8_BIT_MASK) | ((addr + 1) & LOW_8_BIT_MASK);
+    cpu->fetched_address = (cpu_read(high_addr) << 8) | cpu_read(addr);
+#endif
 
     return 0x00;
 }
@@ -250,8 +479,77 @@ uint8_t MODE_INY() {
     return 0x00;
 }
 
+// 65C02 only. The next byte is a zero page pointer to the address where the data is.
+uint8_t MODE_ZPI() {
+    uint8_t ptr = cpu_read(cpu->pc++);
+    cpu->fetched_address = (cpu_read((uint8_t)(ptr + 1)) << 8) | cpu_read(ptr);
+
+    return 0x00;
+}
+
+// 65C02 only, used by JMP. The next two bytes are added with the X register and point to the address.
+uint8_t MODE_IAX() {
+    uint8_t low_byte = cpu_read(cpu->pc++);
+    uint8_t high_byte = cpu_read(cpu->pc++);
+
+    uint16_t addr = ((high_byte << 8) | low_byte) + cpu->x;
+    cpu->fetched_address = (cpu_read(addr + 1) << 8) | cpu_read(addr);
+
+    return 0x00;
+}
+
+// The ALU primitives below are shared by the documented opcodes and the undocumented ones built from them.
+static void set_zn(uint8_t value) {
+    set_flag(Z, value == 0x00);
+    set_flag(N, value & N_FLAG_MASK);
+}
+
+// Stores the result of a read-modify-write instruction back where its operand came from.
+static void write_back(uint8_t data) {
+    if (instructions[cpu->opcode].address_mode == &MODE_ACC)
+        cpu->a = data;
+    else
+        cpu_write(cpu->fetched_address, data);
+}
+
+static uint8_t shift_left(uint8_t value) {
+    set_flag(C, value & 0x80);
+    value <<= 1;
+    set_zn(value);
+    return value;
+}
+
+static uint8_t shift_right(uint8_t value) {
+    set_flag(C, value & 0x01);
+    value >>= 1;
+    set_zn(value);
+    return value;
+}
+
+static uint8_t rotate_left(uint8_t value) {
+    uint8_t carry = get_flag(C);
+    set_flag(C, value & 0x80);
+    value = (value << 1) | carry;
+    set_zn(value);
+    return value;
+}
+
+static uint8_t rotate_right(uint8_t value) {
+    uint8_t carry = get_flag(C);
+    set_flag(C, value & 0x01);
+    value = (value >> 1) | (carry << 7);
+    set_zn(value);
+    return value;
+}
+
+static void compare(uint8_t reg, uint8_t value) {
+    set_flag(C, reg >= value);
+    set_zn(reg - value);
+}
+
 // This opcode is for illegal operations.
 uint8_t ILL() {
+    cpu->illegal_count++;
     return 0x00;
 }
 
@@ -263,18 +561,30 @@ uint8_t NOP() {
 // Load memory into a register.
 uint8_t LDA() {
     cpu->a = fetch();
+
+    set_flag(Z, cpu->a == 0x00);
+    set_flag(N, cpu->a & N_FLAG_MASK);
+
     return 0x00;
 }
 
 // Load memory into x register.
 uint8_t LDX() {
     cpu->x = fetch();
+
+    set_flag(Z, cpu->x == 0x00);
+    set_flag(N, cpu->x & N_FLAG_MASK);
+
     return 0x00;
 }
 
 //Load memory into y register.
 uint8_t LDY() {
     cpu->y = fetch();
+
+    set_flag(Z, cpu->y == 0x00);
+    set_flag(N, cpu->y & N_FLAG_MASK);
+
     return 0x00;
 }
 
@@ -368,14 +678,12 @@ uint8_t ORA() {
 
 uint8_t PHA() {
     cpu_write(STACK_PTR_ADR + cpu->sp--, cpu->a);
+    return 0x00;
 }
 
 uint8_t PHP() {
-    cpu_write(STACK_PTR_ADR + cpu->sp--, cpu->status);
-
-    set_flag(B, true);
-    set_flag(C, true);
-
+    //B and U are only set in the pushed copy.
+    cpu_write(STACK_PTR_ADR + cpu->sp--, cpu->status | B | U);
     return 0x00;
 }
 
@@ -392,47 +700,25 @@ uint8_t PLA() {
 uint8_t PLP() {
     cpu->sp++;
     uint8_t stat = cpu_read(STACK_PTR_ADR + cpu->sp);
-    cpu->status = (stat & 0x11001111);  //The U and B flags are ignored.
+    cpu->status = (stat & ~B) | U;  //The U and B flags are ignored.
 
     return 0x00;
 }
 
 uint8_t ROL() {
-    uint16_t data = fetch();
-    data = (uint16_t)(data << 1) | get_flag(C);
-
-    set_flag(Z, (data & 0x00FF) == 0x0000);
-    set_flag(N, data & N_FLAG_MASK);
-    set_flag(C, (data & 0xFF00));
-
-    if (instructions[cpu->opcode].address_mode == &MODE_ACC)
-        cpu->a = data;
-    else
-        cpu_write(cpu->fetched_address, data);
-
+    write_back(rotate_left(fetch()));
     return 0x00;
 }
 
 uint8_t ROR() {
-    uint16_t data = fetch();
-    data = (uint16_t)(data >> 1) | get_flag(C);
-
-    set_flag(Z, (data & 0x00FF) == 0x0000);
-    set_flag(N, data & N_FLAG_MASK);
-    set_flag(C, (data & 0xFF00));
-
-    if (instructions[cpu->opcode].address_mode == &MODE_ACC)
-        cpu->a = data;
-    else
-        cpu_write(cpu->fetched_address, data);
-
+    write_back(rotate_right(fetch()));
     return 0x00;
 }
 
 uint8_t RTI() {
     cpu->sp++;
     uint8_t stat = cpu_read(STACK_PTR_ADR + cpu->sp);
-    cpu->status = (stat & 0x11001111);  //The U and B flags are ignored.
+    cpu->status = (stat & ~B) | U;  //The U and B flags are ignored.
 
     cpu->sp++;
     uint8_t low = cpu_read(STACK_PTR_ADR + cpu->sp);
@@ -489,10 +775,8 @@ uint8_t DEC() {
     uint8_t data = fetch();
     data--;
 
-    set_flag(Z, (data == 0x00));
-    set_flag(N, (N_FLAG_MASK & data));
-
-    cpu_write(cpu->fetched_address, data);
+    set_zn(data);
+    write_back(data);
     return 0x00;
 }
 
@@ -516,10 +800,8 @@ uint8_t INC() {
     uint8_t data = fetch();
     data++;
 
-    set_flag(Z, (data == 0x00));
-    set_flag(N, (N_FLAG_MASK & data));
-
-    cpu_write(cpu->fetched_address, data);
+    set_zn(data);
+    write_back(data);
     return 0x00;
 } 
 
@@ -556,96 +838,139 @@ uint8_t EOR() {
 }
 
 uint8_t ASL() {
-    uint16_t data = fetch();
-    data = (uint16_t)data << 1;
-
-    set_flag(Z, (data & 0x00FF) == 0x0000);
-    set_flag(N, (N_FLAG_MASK & data));
-    set_flag(C, (data & 0xFF00));
-
-    if (instructions[cpu->opcode].address_mode == &MODE_ACC)
-        cpu->a = data;
-    else
-        cpu_write(cpu->fetched_address, data);
-
+    write_back(shift_left(fetch()));
     return 0x00;
 }
 
 uint8_t LSR() {
-    uint16_t data = fetch();
-    data = (uint16_t)data >> 1;
-
-    set_flag(Z, (data & 0x00FF) == 0x0000);
-    set_flag(N, false);
-    set_flag(C, (data & 0xFF00));
-
-    if (instructions[cpu->opcode].address_mode == &MODE_ACC)
-        cpu->a = data;
-    else
-        cpu_write(cpu->fetched_address, data);
-
+    write_back(shift_right(fetch()));
     return 0x00;
 }
 
-uint8_t ADC() {
-    uint16_t data = cpu->a + fetch() + (uint16_t) get_flag(C);
-    set_flag(C, (data & 0x0100));
-    set_flag(N, (data & N_FLAG_MASK));
-    set_flag(Z, ((data & 0x00FF) == 0x00));
-
-    set_flag(V, (~((cpu->a ^ fetch()) & (cpu->a & data)) & 0x0080));
+// Binary addition shared by ADC and SBC, SBC adds the one's complement of its operand.
+static void add_binary(uint8_t value) {
+    uint16_t data = cpu->a + value + (uint16_t) get_flag(C);
 
+    set_flag(C, (data & 0x0100));
+    set_flag(V, (~(cpu->a ^ value) & (cpu->a ^ data)) & N_FLAG_MASK);
 
     cpu->a = (data & 0x00FF);
+    set_flag(Z, (cpu->a == 0x00));
+    set_flag(N, (cpu->a & N_FLAG_MASK));
+}
+
+// ADC on the accumulator, in decimal when the D flag is set on the parts that have it.
+static void add(uint8_t value) {
+#if CPU_VARIANT == CPU_2A03
+    add_binary(value);
+#else
+    if (get_flag(D) == 0) {
+        add_binary(value);
+        return;
+    }
 
-    return 0x00;
-}
+    // Decimal mode, following the sequences in Bruce Clark's "Decimal Mode" tutorial.
+    int low = (cpu->a & 0x0F) + (value & 0x0F) + get_flag(C);
+    if (low >= 0x0A)
+        low = ((low + 0x06) & 0x0F) + 0x10;
 
-uint8_t SBC() {
-    uint16_t fetched = fetch();
-    fetched = (fetched ^ 0x00FF) + 1; //This gives me the two's complement 
+    int data = (cpu->a & 0xF0) + (value & 0xF0) + low;
+    int overflow = (int8_t)(cpu->a & 0xF0) + (int8_t)(value & 0xF0) + low;
+    set_flag(V, overflow < -128 || overflow > 127);
 
-    uint16_t data = cpu->a + fetched + (uint16_t) get_flag(C);
-    set_flag(C, (data & 0x0100));
+#if CPU_VARIANT == CPU_NMOS
+    // The NMOS parts take N from the sum before the high digit is adjusted and Z from the binary sum.
     set_flag(N, (data & N_FLAG_MASK));
-    set_flag(Z, ((data & 0x00FF) == 0x00));
+    set_flag(Z, ((cpu->a + value + get_flag(C)) & 0x00FF) == 0x00);
+#endif
 
-    set_flag(V, (~((cpu->a ^ fetch()) & (cpu->a & data)) & 0x0080));
+    if (data >= 0xA0)
+        data += 0x60;
+    set_flag(C, data >= 0x100);
+    cpu->a = (data & 0x00FF);
 
+#if CPU_VARIANT == CPU_65C02
+    set_flag(Z, (cpu->a == 0x00));
+    set_flag(N, (cpu->a & N_FLAG_MASK));
+    cpu->cycles++;
+#endif
+#endif
+}
+
+// SBC on the accumulator, in decimal when the D flag is set on the parts that have it.
+static void subtract(uint8_t value) {
+#if CPU_VARIANT == CPU_2A03
+    add_binary(~value);
+#else
+    if (get_flag(D) == 0) {
+        add_binary(~value);
+        return;
+    }
+
+    uint8_t a = cpu->a;
+    int borrow = 1 - get_flag(C);
+
+    // C and V come from the binary subtraction on every part. The NMOS parts also keep its N and Z.
+    add_binary(~value);
+
+    int low = (a & 0x0F) - (value & 0x0F) - borrow;
+#if CPU_VARIANT == CPU_NMOS
+    if (low < 0)
+        low = ((low - 0x06) & 0x0F) - 0x10;
 
+    int data = (a & 0xF0) - (value & 0xF0) + low;
+    if (data < 0)
+        data -= 0x60;
     cpu->a = (data & 0x00FF);
+#else
+    int data = a - value - borrow;
+    if (data < 0)
+        data -= 0x60;
+    if (low < 0)
+        data -= 0x06;
+    cpu->a = (data & 0x00FF);
+
+    set_flag(Z, (cpu->a == 0x00));
+    set_flag(N, (cpu->a & N_FLAG_MASK));
+    cpu->cycles++;
+#endif
+#endif
+}
 
+uint8_t ADC() {
+    add(fetch());
     return 0x00;
 }
 
-uint8_t CMP() {
-    set_flag(N, (cpu->a < fetch()));
-    set_flag(Z, (cpu->a == fetch()));
-    set_flag(C, (cpu->a == fetch() || cpu->a > fetch()));
+uint8_t SBC() {
+    subtract(fetch());
+    return 0x00;
+}
 
+uint8_t CMP() {
+    compare(cpu->a, fetch());
     return 0x00;
 }
 
 uint8_t CPX() {
-    set_flag(N, (cpu->x < fetch()));
-    set_flag(Z, (cpu->x == fetch()));
-    set_flag(C, (cpu->x == fetch() || cpu->x > fetch()));
-
+    compare(cpu->x, fetch());
     return 0x00;
 }
 
 uint8_t CPY() {
-    set_flag(N, (cpu->y < fetch()));
-    set_flag(Z, (cpu->y == fetch()));
-    set_flag(C, (cpu->y == fetch() || cpu->y > fetch()));
-
+    compare(cpu->y, fetch());
     return 0x00;
 }
 
 uint8_t BIT() {
-    set_flag(N, fetch() & N_FLAG_MASK);
-    set_flag(V, fetch() & 0x40);
-    set_flag(Z, (fetch() & cpu->a) == 0x00);
+    uint8_t data = fetch();
+
+    // The 65C02's BIT #imm only sets Z.
+    if (instructions[cpu->opcode].address_mode != &MODE_IMM) {
+        set_flag(N, data & N_FLAG_MASK);
+        set_flag(V, data & 0x40);
+    }
+    set_flag(Z, (data & cpu->a) == 0x00);
 
     return 0x00;
 }
@@ -677,11 +1002,14 @@ uint8_t BEQ() {
 } 
 
 uint8_t BMI() {
+    if (get_flag(N) == 1)
+        cpu->pc = cpu->fetched_address;
+
     return 0x00;
 }
 
 uint8_t BNE() {
-    if (get_flag(N) == 1)
+    if (get_flag(Z) == 0)
         cpu->pc = cpu->fetched_address;
 
     return 0x00;
@@ -709,18 +1037,73 @@ uint8_t BVC() {
 }
 
 uint8_t BRK() {
-    set_flag(I, true);
-
+    // The byte after BRK is skipped, RTI returns past it.
     cpu->pc++;
-    cpu_write(STACK_PTR_ADR + cpu->sp, (cpu->pc << 8) & 0x00FF);
-    cpu->sp--;
-    cpu_write(STACK_PTR_ADR + cpu->sp, (cpu->sp & 0x00FF));
-    cpu->sp--;
+    enter_handler(IRQ_VECTOR, true);
+    return 0x00;
+}
 
-    set_flag(B, true);
-    cpu_write(STACK_PTR_ADR + cpu->sp, cpu->status);
-    cpu->sp--;
-    set_flag(B, false);
+// 65C02 only. Branch always.
+uint8_t BRA() {
+    cpu->pc = cpu->fetched_address;
+    return 0x00;
+}
+
+// 65C02 only. Push x register.
+uint8_t PHX() {
+    cpu_write(STACK_PTR_ADR + cpu->sp--, cpu->x);
+    return 0x00;
+}
+
+// 65C02 only. Push y register.
+uint8_t PHY() {
+    cpu_write(STACK_PTR_ADR + cpu->sp--, cpu->y);
+    return 0x00;
+}
+
+// 65C02 only. Pull x register.
+uint8_t PLX() {
+    cpu->sp++;
+    cpu->x = cpu_read(STACK_PTR_ADR + cpu->sp);
+
+    set_flag(Z, cpu->x == 0x00);
+    set_flag(N, cpu->x & N_FLAG_MASK);
+
+    return 0x00;
+}
+
+// 65C02 only. Pull y register.
+uint8_t PLY() {
+    cpu->sp++;
+    cpu->y = cpu_read(STACK_PTR_ADR + cpu->sp);
+
+    set_flag(Z, cpu->y == 0x00);
+    set_flag(N, cpu->y & N_FLAG_MASK);
+
+    return 0x00;
+}
+
+// 65C02 only. Store zero in memory.
+uint8_t STZ() {
+    cpu_write(cpu->fetched_address, 0x00);
+    return 0x00;
+}
+
+// 65C02 only. Clear the bits of a register in memory.
+uint8_t TRB() {
+    uint8_t data = fetch();
+    set_flag(Z, (data & cpu->a) == 0x00);
+
+    cpu_write(cpu->fetched_address, data & ~cpu->a);
+    return 0x00;
+}
+
+// 65C02 only. Set the bits of a register in memory.
+uint8_t TSB() {
+    uint8_t data = fetch();
+    set_flag(Z, (data & cpu->a) == 0x00);
+
+    cpu_write(cpu->fetched_address, data | cpu->a);
     return 0x00;
 }
 
@@ -729,12 +1112,8 @@ uint8_t RTS() {
     uint8_t low = cpu_read(STACK_PTR_ADR + cpu->sp);
     cpu->sp++;
     uint8_t high = cpu_read(STACK_PTR_ADR + cpu->sp);
-    cpu->pc = (high << 8) | low;
-
-    low = cpu_read(RESET_VECTOR);
-    high = cpu_read(RESET_VECTOR + 1);
-
-    cpu->pc = (high << 8) | low;
+    // JSR pushed the address of its last byte.
+    cpu->pc = ((high << 8) | low) + 1;
     return 0x00;
 } 
 
@@ -747,3 +1126,123 @@ uint8_t JSR() {
     cpu->pc = cpu->fetched_address;
     return 0x00;
 }
+
+// The undocumented NMOS opcodes, combinations of the primitives the documented ones use.
+
+// LDA and LDX with the same operand.
+uint8_t LAX() {
+    cpu->a = cpu->x = fetch();
+    set_zn(cpu->a);
+    return 0x00;
+}
+
+// Store a and x anded together, the flags are left alone.
+uint8_t SAX() {
+    cpu_write(cpu->fetched_address, cpu->a & cpu->x);
+    return 0x00;
+}
+
+// ASL memory then ORA it.
+uint8_t SLO() {
+    uint8_t data = shift_left(fetch());
+    write_back(data);
+
+    cpu->a |= data;
+    set_zn(cpu->a);
+    return 0x00;
+}
+
+// ROL memory then AND it.
+uint8_t RLA() {
+    uint8_t data = rotate_left(fetch());
+    write_back(data);
+
+    cpu->a &= data;
+    set_zn(cpu->a);
+    return 0x00;
+}
+
+// LSR memory then EOR it.
+uint8_t SRE() {
+    uint8_t data = shift_right(fetch());
+    write_back(data);
+
+    cpu->a ^= data;
+    set_zn(cpu->a);
+    return 0x00;
+}
+
+// ROR memory then ADC it, the carry out of the rotate goes into the addition.
+uint8_t RRA() {
+    uint8_t data = rotate_right(fetch());
+    write_back(data);
+
+    add(data);
+    return 0x00;
+}
+
+// DEC memory then CMP it.
+uint8_t DCP() {
+    uint8_t data = fetch() - 1;
+    write_back(data);
+
+    compare(cpu->a, data);
+    return 0x00;
+}
+
+// INC memory then SBC it.
+uint8_t ISC() {
+    uint8_t data = fetch() + 1;
+    write_back(data);
+
+    subtract(data);
+    return 0x00;
+}
+
+// AND immediate, the carry gets a copy of N.
+uint8_t ANC() {
+    cpu->a &= fetch();
+    set_zn(cpu->a);
+    set_flag(C, cpu->a & N_FLAG_MASK);
+    return 0x00;
+}
+
+// AND immediate then LSR the accumulator.
+uint8_t ALR() {
+    cpu->a = shift_right(cpu->a & fetch());
+    return 0x00;
+}
+
+// AND immediate then ROR the accumulator, with C and V taken from bits 6 and 5 of the result.
+// The NMOS decimal mode quirks of ARR are not emulated.
+uint8_t ARR() {
+    cpu->a = (cpu->a & fetch()) >> 1 | (get_flag(C) << 7);
+    set_zn(cpu->a);
+    set_flag(C, cpu->a & 0x40);
+    set_flag(V, ((cpu->a >> 6) ^ (cpu->a >> 5)) & 0x01);
+    return 0x00;
+}
+
+// x becomes a and x anded together minus the immediate, without borrow, setting the flags like CMP.
+uint8_t SBX() {
+    uint8_t data = cpu->a & cpu->x;
+    uint8_t value = fetch();
+
+    compare(data, value);
+    cpu->x = data - value;
+    return 0x00;
+}
+
+// a, x and the stack pointer become memory anded with the stack pointer.
+uint8_t LAS() {
+    cpu->a = cpu->x = cpu->sp = fetch() & cpu->sp;
+    set_zn(cpu->a);
+    return 0x00;
+}
+
+// Locks up the cpu until reset. The pc stays on the opcode so it keeps being executed.
+uint8_t JAM() {
+    cpu->pc--;
+    cpu->halted = true;
+    return 0x00;
+}
@@ -0,0 +1,464 @@
+#include "../include/disasm.h"
+#include "../include/cpu.h"
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+static OpcodeInfo opcode_info[256];
+#ifndef _WIN32
+static pthread_once_t opcode_info_once = PTHREAD_ONCE_INIT;
+#else
+static bool opcode_info_ready = false;
+#endif
+
+static const uint8_t mode_length[] = {
+    [ADDR_IMP] = 1, [ADDR_ACC] = 1, [ADDR_IMM] = 2,
+    [ADDR_ABS] = 3, [ADDR_ZP] = 2,  [ADDR_REL] = 2,
+    [ADDR_IND] = 3, [ADDR_ABX] = 3, [ADDR_ABY] = 3,
+    [ADDR_ZPX] = 2, [ADDR_ZPY] = 2,
+    [ADDR_INX] = 2, [ADDR_INY] = 2,
+    [ADDR_ZPI] = 2, [ADDR_IAX] = 3,
+};
+
+static AddressModeKind mode_kind(AddressMode mode) {
+    if (mode == &MODE_ACC) return ADDR_ACC;
+    if (mode == &MODE_IMM) return ADDR_IMM;
+    if (mode == &MODE_ABS) return ADDR_ABS;
+    if (mode == &MODE_ZP)  return ADDR_ZP;
+    if (mode == &MODE_REL) return ADDR_REL;
+    if (mode == &MODE_IND) return ADDR_IND;
+    if (mode == &MODE_ABX) return ADDR_ABX;
+    if (mode == &MODE_ABY) return ADDR_ABY;
+    if (mode == &MODE_ZPX) return ADDR_ZPX;
+    if (mode == &MODE_ZPY) return ADDR_ZPY;
+    if (mode == &MODE_INX) return ADDR_INX;
+    if (mode == &MODE_INY) return ADDR_INY;
+    if (mode == &MODE_ZPI) return ADDR_ZPI;
+    if (mode == &MODE_IAX) return ADDR_IAX;
+    return ADDR_IMP;
+}
+
+static FlowKind flow_kind(const Instruction* instruction, AddressModeKind mode) {
+    // Every relative instruction is a branch, even the ones whose handler is missing from the table.
+    if (instruction->opcode == &BRA) return FLOW_JUMP;
+    if (mode == ADDR_REL) return FLOW_BRANCH;
+    if (instruction->opcode == &JMP) return (mode == ADDR_ABS) ? FLOW_JUMP : FLOW_JUMP_INDIRECT;
+    if (instruction->opcode == &JSR) return FLOW_CALL;
+    if (instruction->opcode == &RTS || instruction->opcode == &RTI) return FLOW_RETURN;
+    if (instruction->opcode == &BRK) return FLOW_BREAK;
+    if (instruction->opcode == &ILL || instruction->opcode == &JAM) return FLOW_ILLEGAL;
+    return FLOW_NONE;
+}
+
+// The decode table is derived once from instructions[] so decoding never compares function pointers.
+static void build_opcode_info() {
+    for (int i = 0; i < 256; i++) {
+        opcode_info[i].mode = mode_kind(instructions[i].address_mode);
+        opcode_info[i].flow = flow_kind(&instructions[i], opcode_info[i].mode);
+        opcode_info[i].length = mode_length[opcode_info[i].mode];
+    }
+}
+
+// Hosts may disassemble and assemble from several threads at once, the first call builds the table.
+// Without pthreads the first call has to come from one thread.
+const OpcodeInfo* disasm_opcode_info(uint8_t opcode) {
+#ifndef _WIN32
+    pthread_once(&opcode_info_once, &build_opcode_info);
+#else
+    if (!opcode_info_ready) {
+        build_opcode_info();
+        opcode_info_ready = true;
+    }
+#endif
+    return &opcode_info[opcode];
+}
+
+void disasm_decode(const uint8_t* memory, uint16_t address, DisasmInstruction* instruction) {
+    const OpcodeInfo* info = disasm_opcode_info(memory[address]);
+
+    instruction->address = address;
+    instruction->opcode = memory[address];
+    instruction->length = info->length;
+    instruction->mode = info->mode;
+    instruction->flow = info->flow;
+    instruction->operand = 0x0000;
+    instruction->target = 0x0000;
+
+    if (info->length == 2)
+        instruction->operand = memory[(uint16_t)(address + 1)];
+    else if (info->length == 3)
+        instruction->operand = (memory[(uint16_t)(address + 2)] << 8) | memory[(uint16_t)(address + 1)];
+
+    if (info->mode == ADDR_REL)
+        instruction->target = (uint16_t)(address + 2 + (int8_t) instruction->operand);
+    else if (info->flow == FLOW_JUMP || info->flow == FLOW_CALL)
+        instruction->target = instruction->operand;
+}
+
+// Formats the instruction, using the label in place of the target address when one is given.
+static int format_instruction(const DisasmInstruction* instruction, const char* label, char* buf, size_t size) {
+    const char* name = instructions[instruction->opcode].name;
+    uint16_t operand = instruction->operand;
+    char target[16];
+
+    if (label)
+        snprintf(target, sizeof(target), "%s", label);
+    else
+        snprintf(target, sizeof(target), "$%04X", (instruction->mode == ADDR_REL) ? instruction->target : operand);
+
+    switch (instruction->mode) {
+    case ADDR_IMP: return snprintf(buf, size, "%s", name);
+    case ADDR_ACC: return snprintf(buf, size, "%s A", name);
+    case ADDR_IMM: return snprintf(buf, size, "%s #$%02X", name, operand);
+    case ADDR_ZP:  return snprintf(buf, size, "%s $%02X", name, operand);
+    case ADDR_ZPX: return snprintf(buf, size, "%s $%02X,X", name, operand);
+    case ADDR_ZPY: return snprintf(buf, size, "%s $%02X,Y", name, operand);
+    case ADDR_INX: return snprintf(buf, size, "%s ($%02X,X)", name, operand);
+    case ADDR_INY: return snprintf(buf, size, "%s ($%02X),Y", name, operand);
+    case ADDR_ABS: return snprintf(buf, size, "%s %s", name, target);
+    case ADDR_REL: return snprintf(buf, size, "%s %s", name, target);
+    case ADDR_ABX: return snprintf(buf, size, "%s $%04X,X", name, operand);
+    case ADDR_ABY: return snprintf(buf, size, "%s $%04X,Y", name, operand);
+    case ADDR_IND: return snprintf(buf, size, "%s ($%04X)", name, operand);
+    case ADDR_ZPI: return snprintf(buf, size, "%s ($%02X)", name, operand);
+    case ADDR_IAX: return snprintf(buf, size, "%s ($%04X,X)", name, operand);
+    }
+    return 0;
+}
+
+int disasm_format(const DisasmInstruction* instruction, char* buf, size_t size) {
+    return format_instruction(instruction, NULL, buf, size);
+}
+
+typedef struct {
+    uint16_t* items;
+    size_t count;
+} Worklist;
+
+static void add_leader(DisasmAnalysis* analysis, Worklist* worklist, uint16_t address, uint8_t flags) {
+    uint8_t old = analysis->flags[address];
+    analysis->flags[address] |= DISASM_LEADER | flags;
+
+    // An address already decoded only needs the leader flag to split its block.
+    if (!(old & (DISASM_LEADER | DISASM_CODE)))
+        worklist->items[worklist->count++] = address;
+}
+
+static void trace(DisasmAnalysis* analysis, Worklist* worklist) {
+    DisasmInstruction instruction;
+
+    while (worklist->count > 0) {
+        uint16_t address = worklist->items[--worklist->count];
+
+        while (!(analysis->flags[address] & DISASM_CODE)) {
+            disasm_decode(analysis->memory, address, &instruction);
+
+            analysis->flags[address] |= DISASM_CODE;
+            for (int i = 1; i < instruction.length; i++)
+                analysis->flags[(uint16_t)(address + i)] |= DISASM_OPERAND;
+
+            uint16_t next = address + instruction.length;
+            if (next < address)
+                break;
+
+            switch (instruction.flow) {
+            case FLOW_NONE:
+                address = next;
+                continue;
+            case FLOW_BRANCH:
+                add_leader(analysis, worklist, instruction.target, DISASM_JUMP_TARGET);
+                add_leader(analysis, worklist, next, 0);
+                break;
+            case FLOW_JUMP:
+                add_leader(analysis, worklist, instruction.target, DISASM_JUMP_TARGET);
+                break;
+            case FLOW_CALL:
+                add_leader(analysis, worklist, instruction.target, DISASM_FUNCTION);
+                add_leader(analysis, worklist, next, 0);
+                break;
+            default:
+                break;
+            }
+            break;
+        }
+    }
+}
+
+static void build_block(DisasmAnalysis* analysis, uint16_t start, DisasmBlock* block) {
+    DisasmInstruction instruction;
+    uint32_t address = start;
+
+    memset(block, 0, sizeof(DisasmBlock));
+    block->start = start;
+    block->function = start;
+
+    while (true) {
+        disasm_decode(analysis->memory, address, &instruction);
+        block->last = address;
+        block->instruction_count++;
+
+        uint32_t next = address + instruction.length;
+        block->end = next;
+        block->exit = instruction.flow;
+
+        if (instruction.flow != FLOW_NONE || next > 0xFFFF)
+            break;
+        if (!(analysis->flags[next] & DISASM_CODE) || (analysis->flags[next] & DISASM_LEADER))
+            break;
+        address = next;
+    }
+
+    uint16_t next = (uint16_t) block->end;
+    bool has_next = block->end <= 0xFFFF && (analysis->flags[next] & DISASM_CODE);
+
+    switch (block->exit) {
+    case FLOW_BRANCH:
+        block->successors[block->successor_count++] = instruction.target;
+        if (has_next) block->successors[block->successor_count++] = next;
+        break;
+    case FLOW_JUMP:
+        block->successors[block->successor_count++] = instruction.target;
+        break;
+    case FLOW_NONE:
+    case FLOW_CALL:
+        if (has_next) block->successors[block->successor_count++] = next;
+        break;
+    default:
+        break;
+    }
+}
+
+// Assigns every block reachable from the function entry, without entering other functions, to it.
+static void assign_function(DisasmAnalysis* analysis, uint16_t entry, uint8_t* owned, uint16_t* stack) {
+    size_t count = 0;
+    stack[count++] = entry;
+
+    while (count > 0) {
+        int32_t index = analysis->block_index[stack[--count]];
+        if (index < 0 || owned[index])
+            continue;
+
+        DisasmBlock* block = &analysis->blocks[index];
+        if (block->start != entry && (analysis->flags[block->start] & DISASM_FUNCTION))
+            continue;
+
+        owned[index] = 1;
+        block->function = entry;
+        for (int i = 0; i < block->successor_count; i++)
+            stack[count++] = block->successors[i];
+    }
+}
+
+static int compare_calls(const void* a, const void* b) {
+    const DisasmCall* left = a;
+    const DisasmCall* right = b;
+
+    if (left->callee != right->callee) return left->callee - right->callee;
+    if (left->caller != right->caller) return left->caller - right->caller;
+    return left->site - right->site;
+}
+
+DisasmAnalysis* disasm_analyze(const uint8_t* memory, const uint16_t* entries, size_t entry_count) {
+    DisasmAnalysis* analysis = malloc(sizeof(DisasmAnalysis));
+    Worklist worklist;
+    worklist.items = malloc(sizeof(uint16_t) * (DISASM_MEMORY_SIZE * 2 + 1));
+    worklist.count = 0;
+
+    if (!analysis || !worklist.items) {
+        fprintf(stderr, "Unable to allocate memory for the disassembler.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    analysis->memory = memory;
+    memset(analysis->flags, 0, sizeof(analysis->flags));
+    memset(analysis->block_index, 0xFF, sizeof(analysis->block_index));
+
+    for (size_t i = 0; i < entry_count; i++)
+        add_leader(analysis, &worklist, entries[i], DISASM_ENTRY | DISASM_FUNCTION);
+    trace(analysis, &worklist);
+
+    size_t block_count = 0;
+    for (uint32_t address = 0; address < DISASM_MEMORY_SIZE; address++) {
+        if ((analysis->flags[address] & (DISASM_LEADER | DISASM_CODE)) == (DISASM_LEADER | DISASM_CODE))
+            block_count++;
+    }
+
+    analysis->blocks = malloc(sizeof(DisasmBlock) * (block_count + 1));
+    if (!analysis->blocks) {
+        fprintf(stderr, "Unable to allocate memory for the disassembler.\n");
+        exit(EXIT_FAILURE);
+    }
+    analysis->block_count = 0;
+    size_t call_count = 0;
+
+    for (uint32_t address = 0; address < DISASM_MEMORY_SIZE; address++) {
+        if ((analysis->flags[address] & (DISASM_LEADER | DISASM_CODE)) != (DISASM_LEADER | DISASM_CODE))
+            continue;
+
+        DisasmBlock* block = &analysis->blocks[analysis->block_count];
+        build_block(analysis, address, block);
+        analysis->block_index[address] = analysis->block_count++;
+
+        if (block->exit == FLOW_CALL)
+            call_count++;
+    }
+
+    uint8_t* owned = calloc(analysis->block_count + 1, 1);
+    if (!owned) {
+        fprintf(stderr, "Unable to allocate memory for the disassembler.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t address = 0; address < DISASM_MEMORY_SIZE; address++) {
+        if ((analysis->flags[address] & DISASM_FUNCTION) && analysis->block_index[address] >= 0)
+            assign_function(analysis, address, owned, worklist.items);
+    }
+    free(owned);
+
+    analysis->calls = malloc(sizeof(DisasmCall) * (call_count + 1));
+    if (!analysis->calls) {
+        fprintf(stderr, "Unable to allocate memory for the disassembler.\n");
+        exit(EXIT_FAILURE);
+    }
+    analysis->call_count = 0;
+
+    DisasmInstruction instruction;
+    for (size_t i = 0; i < analysis->block_count; i++) {
+        const DisasmBlock* block = &analysis->blocks[i];
+        if (block->exit != FLOW_CALL)
+            continue;
+
+        disasm_decode(memory, block->last, &instruction);
+        DisasmCall* call = &analysis->calls[analysis->call_count++];
+        call->caller = block->function;
+        call->site = block->last;
+        call->callee = instruction.target;
+    }
+    qsort(analysis->calls, analysis->call_count, sizeof(DisasmCall), &compare_calls);
+
+    free(worklist.items);
+    return analysis;
+}
+
+void disasm_free(DisasmAnalysis* analysis) {
+    if (!analysis)
+        return;
+
+    free(analysis->blocks);
+    free(analysis->calls);
+    free(analysis);
+}
+
+const DisasmBlock* disasm_block_at(const DisasmAnalysis* analysis, uint16_t address) {
+    int32_t index = analysis->block_index[address];
+    return (index < 0) ? NULL : &analysis->blocks[index];
+}
+
+static const char* label_for(const DisasmAnalysis* analysis, uint16_t address, char* buf, size_t size) {
+    uint8_t flags = analysis->flags[address];
+
+    if (!(flags & DISASM_CODE))
+        return NULL;
+    if (flags & DISASM_FUNCTION)
+        snprintf(buf, size, "sub_%04X", address);
+    else if (flags & DISASM_LEADER)
+        snprintf(buf, size, "L%04X", address);
+    else
+        return NULL;
+    return buf;
+}
+
+static void print_callers(const DisasmAnalysis* analysis, uint16_t function, FILE* out) {
+    size_t low = 0, high = analysis->call_count;
+    while (low < high) {
+        size_t mid = (low + high) / 2;
+        if (analysis->calls[mid].callee < function) low = mid + 1;
+        else high = mid;
+    }
+
+    if (low >= analysis->call_count || analysis->calls[low].callee != function)
+        return;
+
+    fprintf(out, "; called from");
+    for (size_t i = low; i < analysis->call_count && analysis->calls[i].callee == function; i++)
+        fprintf(out, " $%04X", analysis->calls[i].site);
+    fprintf(out, "\n");
+}
+
+static void print_instruction(const DisasmInstruction* instruction, const uint8_t* memory, const char* label, FILE* out) {
+    char bytes[12] = "";
+    char text[32];
+
+    for (int i = 0; i < instruction->length; i++)
+        snprintf(bytes + i * 3, sizeof(bytes) - i * 3, "%02X ", memory[(uint16_t)(instruction->address + i)]);
+    format_instruction(instruction, label, text, sizeof(text));
+
+    fprintf(out, "    %04X  %-9s %s\n", instruction->address, bytes, text);
+}
+
+void disasm_print_listing(const DisasmAnalysis* analysis, uint16_t start, uint32_t end, FILE* out) {
+    DisasmInstruction instruction;
+    char label[16];
+    char target_label[16];
+    uint32_t address = start;
+
+    while (address < end) {
+        uint8_t flags = analysis->flags[address];
+
+        if (!(flags & DISASM_CODE)) {
+            fprintf(out, "    %04X  .byte", address);
+            for (int i = 0; i < 8 && address < end && !(analysis->flags[address] & DISASM_CODE); i++, address++)
+                fprintf(out, "%s$%02X", (i == 0) ? " " : ",", analysis->memory[address]);
+            fprintf(out, "\n");
+            continue;
+        }
+
+        if (flags & DISASM_FUNCTION) {
+            fprintf(out, "\n; function sub_%04X%s\n", address, (flags & DISASM_ENTRY) ? " (entry)" : "");
+            print_callers(analysis, address, out);
+        }
+        if (label_for(analysis, address, label, sizeof(label)))
+            fprintf(out, "%s:\n", label);
+
+        disasm_decode(analysis->memory, address, &instruction);
+        const char* target = NULL;
+        if (instruction.mode == ADDR_REL || instruction.flow == FLOW_JUMP || instruction.flow == FLOW_CALL)
+            target = label_for(analysis, instruction.target, target_label, sizeof(target_label));
+        print_instruction(&instruction, analysis->memory, target, out);
+
+        if (instruction.flow != FLOW_NONE && instruction.flow != FLOW_CALL)
+            fprintf(out, "\n");
+        address += instruction.length;
+    }
+}
+
+void disasm_print_linear(const uint8_t* memory, uint16_t start, uint32_t end, FILE* out) {
+    DisasmInstruction instruction;
+    uint32_t address = start;
+
+    while (address < end) {
+        disasm_decode(memory, address, &instruction);
+        print_instruction(&instruction, memory, NULL, out);
+        address += instruction.length;
+    }
+}
+
+void disasm_print_call_graph(const DisasmAnalysis* analysis, FILE* out) {
+    fprintf(out, "digraph calls {\n");
+
+    for (uint32_t address = 0; address < DISASM_MEMORY_SIZE; address++) {
+        if ((analysis->flags[address] & (DISASM_FUNCTION | DISASM_CODE)) == (DISASM_FUNCTION | DISASM_CODE))
+            fprintf(out, "    sub_%04X;\n", address);
+    }
+
+    for (size_t i = 0; i < analysis->call_count; i++) {
+        const DisasmCall* call = &analysis->calls[i];
+        if (i > 0 && call->callee == analysis->calls[i - 1].callee && call->caller == analysis->calls[i - 1].caller)
+            continue;
+        fprintf(out, "    sub_%04X -> sub_%04X;\n", call->caller, call->callee);
+    }
+
+    fprintf(out, "}\n");
+}
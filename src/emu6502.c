@@ -0,0 +1,184 @@
+#include "../include/emu6502.h"
+#include "../include/cpu.h"
+#include "../include/asm.h"
+#include "../include/idle.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RESET_VECTOR 0xFFFC
+
+struct Emu6502 {
+    Bus bus;
+    Cpu* cpu;
+    IdleDetector idle;
+};
+
+// Every call selects the machine's cpu for the calling thread and restores the previous one, so
+// hosts can drive any number of machines from any threads.
+static Cpu* select_machine(Emu6502* machine) {
+    Cpu* previous = get_cpu();
+    cpu_select(machine->cpu);
+    return previous;
+}
+
+int emu6502_api_version(void) {
+    return EMU6502_API_VERSION;
+}
+
+Emu6502* emu6502_create(void) {
+    Emu6502* machine = malloc(sizeof(Emu6502));
+    if (!machine)
+        return NULL;
+
+    if (!bus_init(&machine->bus)) {
+        free(machine);
+        return NULL;
+    }
+
+    Cpu* previous = get_cpu();
+    if (!cpu_init()) {
+        bus_free(&machine->bus);
+        free(machine);
+        return NULL;
+    }
+    cpu_connect_bus(&machine->bus);
+    machine->cpu = get_cpu();
+    idle_init(&machine->idle);
+    cpu_select(previous);
+    return machine;
+}
+
+void emu6502_destroy(Emu6502* machine) {
+    if (!machine)
+        return;
+
+    Cpu* previous = select_machine(machine);
+    cpu_free();
+    cpu_select(previous == machine->cpu ? NULL : previous);
+
+    bus_free(&machine->bus);
+    free(machine);
+}
+
+bool emu6502_load(Emu6502* machine, uint16_t address, const uint8_t* image, size_t length) {
+    // Written so a huge length cannot wrap the sum around.
+    if (length > RAM_SIZE - address)
+        return false;
+
+    memcpy(machine->bus.ram + address, image, length);
+    if (address <= RESET_VECTOR && length <= RESET_VECTOR - address) {
+        machine->bus.ram[RESET_VECTOR] = address & 0x00FF;
+        machine->bus.ram[RESET_VECTOR + 1] = address >> 8;
+    }
+    return true;
+}
+
+bool emu6502_assemble(Emu6502* machine, const char* source, char* error, size_t error_size) {
+    uint8_t* ram = machine->bus.ram;
+    uint8_t vector[2] = { ram[RESET_VECTOR], ram[RESET_VECTOR + 1] };
+
+    // The vector is cleared first so one left by an earlier load is not mistaken for the source's.
+    ram[RESET_VECTOR] = ram[RESET_VECTOR + 1] = 0x00;
+
+    AsmResult result;
+    if (asm_assemble(&machine->bus, source, &result)) {
+        if (ram[RESET_VECTOR] == 0x00 && ram[RESET_VECTOR + 1] == 0x00) {
+            ram[RESET_VECTOR] = result.start & 0x00FF;
+            ram[RESET_VECTOR + 1] = result.start >> 8;
+        }
+        return true;
+    }
+
+    ram[RESET_VECTOR] = vector[0];
+    ram[RESET_VECTOR + 1] = vector[1];
+    if (error && error_size > 0)
+        snprintf(error, error_size, "line %d: %s", result.error_line, result.error);
+    return false;
+}
+
+void emu6502_reset(Emu6502* machine) {
+    Cpu* previous = select_machine(machine);
+    cpu_reset();
+    cpu_select(previous);
+}
+
+uint64_t emu6502_run(Emu6502* machine, uint64_t cycles) {
+    Cpu* previous = select_machine(machine);
+    Cpu* cpu = machine->cpu;
+    uint64_t start = cpu->clock_count;
+    uint64_t end = start + cycles;
+
+    // Halting is only checked between instructions. Idle loops are skipped at most IDLE_MAX_SKIP
+    // cycles at a time, so a guest waiting for the host costs next to nothing, while an IRQ or NMI
+    // another thread raises meanwhile is taken at the next instruction after the current skip
+    // rather than at the end of the run.
+    while (cpu->clock_count < end && !(cpu->halted && cpu->cycles == 0)) {
+        uint16_t pc = cpu->pc;
+        if (cpu_clock() && cpu->pc <= pc) {
+            uint64_t limit = end - cpu->clock_count > IDLE_MAX_SKIP ? cpu->clock_count + IDLE_MAX_SKIP : end;
+            idle_check(&machine->idle, cpu, limit);
+        }
+    }
+
+    cpu_select(previous);
+    return cpu->clock_count - start;
+}
+
+void emu6502_read(Emu6502* machine, uint16_t address, uint8_t* buffer, size_t length) {
+    while (length > 0) {
+        size_t chunk = RAM_SIZE - address < length ? RAM_SIZE - address : length;
+        memcpy(buffer, machine->bus.ram + address, chunk);
+
+        buffer += chunk;
+        length -= chunk;
+        address = (address + chunk) & (RAM_SIZE - 1);
+    }
+}
+
+void emu6502_write(Emu6502* machine, uint16_t address, const uint8_t* data, size_t length) {
+    while (length > 0) {
+        size_t chunk = RAM_SIZE - address < length ? RAM_SIZE - address : length;
+        memcpy(machine->bus.ram + address, data, chunk);
+
+        data += chunk;
+        length -= chunk;
+        address = (address + chunk) & (RAM_SIZE - 1);
+    }
+}
+
+void emu6502_get_registers(Emu6502* machine, Emu6502Registers* registers) {
+    const Cpu* cpu = machine->cpu;
+
+    registers->a = cpu->a;
+    registers->x = cpu->x;
+    registers->y = cpu->y;
+    registers->status = cpu->status;
+    registers->sp = cpu->sp;
+    registers->pc = cpu->pc;
+    registers->cycles = cpu->clock_count;
+    registers->instructions = cpu->instruction_count;
+}
+
+void emu6502_set_registers(Emu6502* machine, const Emu6502Registers* registers) {
+    Cpu* cpu = machine->cpu;
+
+    cpu->a = registers->a;
+    cpu->x = registers->x;
+    cpu->y = registers->y;
+    cpu->status = registers->status;
+    cpu->sp = registers->sp;
+    cpu->pc = registers->pc;
+}
+
+void emu6502_set_irq(Emu6502* machine, uint32_t source, bool asserted) {
+    cpu_set_irq(machine->cpu, source, asserted);
+}
+
+void emu6502_nmi(Emu6502* machine) {
+    cpu_pulse_nmi(machine->cpu);
+}
+
+bool emu6502_halted(Emu6502* machine) {
+    return machine->cpu->halted;
+}
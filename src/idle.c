@@ -0,0 +1,61 @@
+#include "../include/idle.h"
+#include <string.h>
+
+void idle_init(IdleDetector* idle) {
+    memset(idle, 0, sizeof(IdleDetector));
+}
+
+static void arm(IdleDetector* idle, const Cpu* cpu) {
+    idle->head = cpu->pc;
+    idle->a = cpu->a;
+    idle->x = cpu->x;
+    idle->y = cpu->y;
+    idle->status = cpu->status;
+    idle->sp = cpu->sp;
+    idle->clock_count = cpu->clock_count;
+    idle->instruction_count = cpu->instruction_count;
+    idle->read_count = cpu->bus->read_count;
+    idle->write_count = cpu->bus->write_count;
+    idle->mmio_count = cpu->bus->mmio_count;
+    idle->effect_count = cpu->bus->effect_count;
+    idle->armed = true;
+}
+
+// The same point of the same loop with nothing changed since the last time round.
+static bool unchanged(const IdleDetector* idle, const Cpu* cpu) {
+    return idle->armed && cpu->pc == idle->head
+        && cpu->a == idle->a && cpu->x == idle->x && cpu->y == idle->y
+        && cpu->status == idle->status && cpu->sp == idle->sp
+        && cpu->bus->write_count == idle->write_count && cpu->bus->effect_count == idle->effect_count
+        && cpu->instruction_count - idle->instruction_count <= IDLE_MAX_INSTRUCTIONS;
+}
+
+bool idle_check(IdleDetector* idle, Cpu* cpu, uint64_t limit) {
+    // A replay observes the interrupt lines on every instruction, skipping them would lose its place.
+    if (cpu->replay || !unchanged(idle, cpu) || interrupt_pending()) {
+        arm(idle, cpu);
+        return false;
+    }
+
+    uint64_t event = bus_next_event(cpu->bus, cpu->clock_count);
+    if (event < limit)
+        limit = event;
+
+    uint64_t period = cpu->clock_count - idle->clock_count;
+    uint64_t iterations = (limit > cpu->clock_count && period > 0) ? (limit - cpu->clock_count) / period : 0;
+    if (iterations == 0) {
+        arm(idle, cpu);
+        return false;
+    }
+
+    // The loop ends every iteration in this very state, only the counters move on.
+    cpu->clock_count += iterations * period;
+    cpu->instruction_count += iterations * (cpu->instruction_count - idle->instruction_count);
+    cpu->bus->read_count += iterations * (cpu->bus->read_count - idle->read_count);
+    cpu->bus->mmio_count += iterations * (cpu->bus->mmio_count - idle->mmio_count);
+
+    idle->skips++;
+    idle->skipped_cycles += iterations * period;
+    arm(idle, cpu);
+    return true;
+}
@@ -2,46 +2,96 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <getopt.h>
 #include "../include/bus.h"
 #include "../include/cpu.h"
+#include "../include/stats.h"
+#include "../include/replay.h"
+#include "../include/console.h"
+#include "../include/block.h"
+#include "../include/system.h"
+#include "../include/pace.h"
+#include "../include/asm.h"
+#include "../include/rom.h"
+#include "../include/idle.h"
 
 #define PC_START 0x8000
 
-FILE* rom = NULL;
-Bus bus;
-uint16_t program_end = 0x00;
+// Where co-processors given with -m meet the primary cpu. Every co-processor gets a mailbox page
+// from the primary and one back to it, starting at MAILBOX_BASE.
+#define SHARED_BASE 0xD000
+#define SHARED_PAGES 0x10
+#define MAILBOX_BASE 0xE000
 
-void close_rom();
+// Assembles the source into the bus and returns where its first section ends. The reset vector
+// points at the first byte unless the source sets it.
+uint16_t assemble_rom(Bus* target, const char* filepath) {
+    FILE* source = fopen(filepath, "rb");
+    if (!source) {
+        printf("Unable to open source file '%s'.\n", filepath);
+        exit(EXIT_FAILURE);
+    }
 
-void load_rom(const char* filepath) {
-    if (rom)
-        close_rom();
+    fseek(source, 0L, SEEK_END);
+    long length = ftell(source);
+    fseek(source, 0L, SEEK_SET);
+
+    char* text = malloc((size_t) length + 1);
+    if (!text) {
+        printf("Unable to allocate memory for '%s'.\n", filepath);
+        exit(EXIT_FAILURE);
+    }
+    text[fread(text, 1, (size_t) length, source)] = '\0';
+    fclose(source);
 
-    rom = fopen(filepath, "r");
+    AsmResult result;
+    bool assembled = asm_assemble(target, text, &result);
+    free(text);
+    if (!assembled) {
+        printf("%s:%d: %s\n", filepath, result.error_line, result.error);
+        exit(EXIT_FAILURE);
+    }
+
+    if (bus_read(target, 0xFFFC) == 0x00 && bus_read(target, 0xFFFD) == 0x00) {
+        bus_write(target, 0xFFFC, (result.start & 0x00FF));
+        bus_write(target, 0xFFFD, (result.start >> 8));
+    }
+    return result.end;
+}
+
+// Loads the rom into the bus at PC_START and returns where the program ends.
+uint16_t load_rom(Bus* target, const char* filepath) {
+    if (rom_is_source(filepath))
+        return assemble_rom(target, filepath);
+
+    FILE* rom = fopen(filepath, "r");
 
     if (!rom) {
         printf("Unable to open rom file '%s'.\n", filepath);
-        return;
+        exit(EXIT_FAILURE);
     }
 
-    fseek(rom, 0L, SEEK_END);
-    program_end = ftell(rom) + PC_START;
-    fseek(rom, 0L, SEEK_SET);
-
-    char buf[4];
+    // The program ends after the last byte read, past it is zeroed ram that would run as BRK.
+    char buf[8];
     uint16_t i = 0;
-    while (fscanf(rom, "%s", buf) != EOF) {
+    while (fscanf(rom, "%7s", buf) != EOF) {
         uint8_t data = (int)strtol(buf, NULL, 0);
-        bus_write(&bus, PC_START + i, data);
+        bus_write(target, PC_START + i, data);
         i++;
     }
+
+    fclose(rom);
+
+    bus_write(target, 0xFFFC, (PC_START & 0x00FF));
+    bus_write(target, 0xFFFD, (PC_START >> 8));
+    return PC_START + i;
 }
 
-void print_rom(uint16_t start, uint16_t end) {
+void print_rom(Bus* bus, uint16_t start, uint16_t end) {
     for (int i = start; i < end; i += 16) {
         printf("0x%04x |", i);
         for (int j = 0; j < 16; j++) {
-            printf(" 0x%02x ", bus_read(&bus, i + j));
+            printf(" 0x%02x ", bus_read(bus, i + j));
 
             if (j == 7)
                 printf("|");
@@ -50,40 +100,233 @@ void print_rom(uint16_t start, uint16_t end) {
     }
 }
 
-void close_rom() {
-    fclose(rom);
-}
-
 int main(int argc, char* argv[]) {
-    bus_init(&bus);
-    
-    if (!argv[1]) {
+    bool publish_stats = false;
+    UndocumentedPolicy undocumented = UNDOCUMENTED_EXECUTE;
+    const char* record_path = NULL;
+    const char* play_path = NULL;
+    const char* disk_path = NULL;
+    long long seek_cycle = -1;
+    long step_back = 0;
+    const char* coprocessors[SYSTEM_MAX_CPUS - 1];
+    int coprocessor_count = 0;
+    uint32_t quantum = SYSTEM_DEFAULT_QUANTUM;
+    bool threaded = false;
+    uint64_t pace_hz = 0;
+    uint32_t pace_burst = 0;
+    PacePolicy pace_policy = PACE_CATCH_UP;
+    bool skip_idle = true;
+    Bus bus;
+    Bus coprocessor_buses[SYSTEM_MAX_CPUS - 1];
+    int option;
+
+    while ((option = getopt(argc, argv, "su:r:p:g:b:d:m:q:tf:k:c:w")) != -1) {
+        switch (option) {
+        case 's': publish_stats = true; break;
+        case 'r': record_path = optarg; break;
+        case 'p': play_path = optarg; break;
+        case 'g': seek_cycle = strtoll(optarg, NULL, 0); break;
+        case 'b': step_back = strtol(optarg, NULL, 0); break;
+        case 'd': disk_path = optarg; break;
+        case 'm':
+            if (coprocessor_count == SYSTEM_MAX_CPUS - 1) {
+                printf("At most %d co-processors are supported.\n", SYSTEM_MAX_CPUS - 1);
+                exit(EXIT_FAILURE);
+            }
+            coprocessors[coprocessor_count++] = optarg;
+            break;
+        case 'q': quantum = (uint32_t) strtoul(optarg, NULL, 0); break;
+        case 't': threaded = true; break;
+        case 'f': pace_hz = strtoull(optarg, NULL, 0); break;
+        case 'w': skip_idle = false; break;
+        case 'k': pace_burst = (uint32_t) strtoul(optarg, NULL, 0); break;
+        case 'c':
+            if (strcmp(optarg, "catchup") == 0) pace_policy = PACE_CATCH_UP;
+            else if (strcmp(optarg, "drop") == 0) pace_policy = PACE_DROP;
+            else {
+                printf("Catch up policy must be catchup or drop.\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'u':
+            if (strcmp(optarg, "execute") == 0) undocumented = UNDOCUMENTED_EXECUTE;
+            else if (strcmp(optarg, "log") == 0) undocumented = UNDOCUMENTED_LOG;
+            else if (strcmp(optarg, "trap") == 0) undocumented = UNDOCUMENTED_TRAP;
+            else {
+                printf("Undocumented opcode policy must be execute, log or trap.\n");
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            printf("Usage: emulator6502 [-s] [-u execute|log|trap] [-r replay | -p replay] [-g cycle] [-b instructions] [-d disk] [-m rom]... [-q quantum] [-t] [-f hz] [-k burst] [-c catchup|drop] [-w] file\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!bus_init(&bus))
+        exit(EXIT_FAILURE);
+
+    if (optind >= argc) {
         printf("Must enter a file to be run...\n");
         exit(EXIT_FAILURE);
     }
-    load_rom(argv[1]);
+    if (coprocessor_count > 0 && (record_path || play_path || seek_cycle >= 0 || step_back > 0)) {
+        printf("Replays only support a single cpu.\n");
+        exit(EXIT_FAILURE);
+    }
+    uint16_t program_end = load_rom(&bus, argv[optind]);
 
-    cpu_init();
-    cpu_connect_bus(&bus);
+    Console console;
+    console_init(&console, &bus, CONSOLE_BASE);
 
-    bus_write(&bus, 0xFFFC, (PC_START & 0x00FF));
-    bus_write(&bus, 0xFFFD, (PC_START >> 8));
+    BlockDevice disk;
+    if (disk_path && !block_open(&disk, &bus, BLOCK_BASE, disk_path))
+        exit(EXIT_FAILURE);
 
+    if (!cpu_init())
+        exit(EXIT_FAILURE);
+    cpu_connect_bus(&bus);
+    cpu_set_undocumented_policy(undocumented);
     cpu_reset();
+    Cpu* primary = get_cpu();
+
+    // Seeking and stepping back need the snapshots of a replay, without -r or -p it is only kept in memory.
+    Replay* replay = NULL;
+    if (play_path)
+        replay = replay_load(get_cpu(), play_path);
+    else if (record_path || seek_cycle >= 0 || step_back > 0)
+        replay = replay_record(get_cpu());
+
+    if (play_path && !replay)
+        exit(EXIT_FAILURE);
+
+    // The counters are sampled every STATS_PUBLISH_INTERVAL instructions so stat6502 can read them while we run.
+    StatsPublisher* stats = publish_stats ? stats_open(argv[optind]) : NULL;
+
+    // Without -f the guest runs flat out, otherwise in bursts held to hz by the wall clock.
+    Pacer pacer;
+    pace_init(&pacer, pace_hz, pace_burst, pace_policy);
+
+    // Loops that wait without changing anything are skipped a whole number of iterations at a time, -w steps through them.
+    IdleDetector idle;
+    idle_init(&idle);
 
-    while (get_cpu()->pc < program_end) {
-        cpu_clock();
+    System system;
+    if (coprocessor_count > 0) {
+        system_init(&system);
+        system.quantum = quantum;
+        system.skip_idle = skip_idle;
+        system.stats = stats;
+        system.pacer = pace_hz > 0 ? &pacer : NULL;
+        system_add_cpu(&system, primary, program_end);
+
+        for (int i = 0; i < coprocessor_count; i++) {
+            if (!bus_init(&coprocessor_buses[i]))
+                exit(EXIT_FAILURE);
+            uint16_t end = load_rom(&coprocessor_buses[i], coprocessors[i]);
+
+            if (!cpu_init())
+                exit(EXIT_FAILURE);
+            cpu_connect_bus(&coprocessor_buses[i]);
+            cpu_set_undocumented_policy(undocumented);
+            cpu_reset();
+            system_add_cpu(&system, get_cpu(), end);
+        }
+
+        system_share(&system, SHARED_BASE, SHARED_PAGES);
+        for (int i = 1; i <= coprocessor_count; i++) {
+            system_connect(&system, 0, i, MAILBOX_BASE + ((i - 1) << (BUS_PAGE_SHIFT + 1)));
+            system_connect(&system, i, 0, MAILBOX_BASE + ((i - 1) << (BUS_PAGE_SHIFT + 1)) + (1 << BUS_PAGE_SHIFT));
+        }
+
+        cpu_select(primary);
+        if (threaded)
+            system_run_threaded(&system);
+        else
+            system_run(&system);
     }
+    else if (pace_hz > 0) {
+        Cpu* cpu = get_cpu();
+        pace_start(&pacer, cpu->clock_count);
+
+        while (cpu->pc < program_end && !cpu->halted) {
+            uint64_t burst_end = cpu->clock_count + pacer.burst;
+            while (cpu->clock_count < burst_end && cpu->pc < program_end && !cpu->halted) {
+                uint16_t pc = cpu->pc;
+                if (cpu_clock()) {
+                    if (stats && cpu->instruction_count >= stats->next_instructions)
+                        stats_publish(stats, cpu, &bus);
+                    if (skip_idle && cpu->pc <= pc)
+                        idle_check(&idle, cpu, burst_end);
+                }
+            }
+            pace_wait(&pacer, cpu->clock_count);
+        }
+    }
+    else {
+        Cpu* cpu = get_cpu();
+
+        while (cpu->pc < program_end && !cpu->halted) {
+            uint16_t pc = cpu->pc;
+            if (cpu_clock()) {
+                if (stats && cpu->instruction_count >= stats->next_instructions)
+                    stats_publish(stats, cpu, &bus);
+                if (skip_idle && cpu->pc <= pc)
+                    idle_check(&idle, cpu, cpu->clock_count + IDLE_MAX_SKIP);
+            }
+        }
+    }
+
+    if (stats) {
+        stats_publish(stats, get_cpu(), &bus);
+        stats_close(stats);
+    }
+
+    console_flush(&console);
+
+    // Seeking and stepping back run the guest again from a snapshot, what it prints then is already out.
+    if (replay) {
+        console.muted = true;
+        if (seek_cycle >= 0 && !replay_seek(replay, seek_cycle))
+            printf("Cannot seek to cycle %lld.\n", seek_cycle);
+        for (long i = 0; i < step_back && replay_step_back(replay); i++)
+            ;
+        console.muted = false;
+        if (record_path)
+            replay_save(replay, record_path);
+    }
+
+    if (get_cpu()->halted)
+        printf("Cpu halted on opcode 0x%02x at 0x%04x.\n", bus_read(&bus, get_cpu()->pc), get_cpu()->pc);
 
     printf("A register = 0x%02x\n", get_cpu()->a);
     printf("X register = 0x%02x\n", get_cpu()->x);
     printf("Y register = 0x%02x\n", get_cpu()->y);
     printf("Staus register = 0x%02x\n", get_cpu()->status);
     printf("PC = 0x%04x\n", get_cpu()->pc);
+    if (replay)
+        printf("Cycle = %llu\n", (unsigned long long) get_cpu()->clock_count);
+    if (pace_hz > 0)
+        pace_report(&pacer, stdout);
+    if (idle.skips > 0)
+        printf("Skipped %llu idle cycles in %llu jumps.\n", (unsigned long long) idle.skipped_cycles, (unsigned long long) idle.skips);
+
+    replay_free(replay);
+    if (coprocessor_count > 0) {
+        system_free(&system);
+        for (int i = 1; i <= coprocessor_count; i++) {
+            cpu_select(system.cpus[i].cpu);
+            cpu_free();
+            bus_free(&coprocessor_buses[i - 1]);
+        }
+        cpu_select(primary);
+    }
+    console_free(&console, &bus);
+    if (disk_path)
+        block_close(&disk);
 
     cpu_free();
     bus_free(&bus);
-    close_rom();
 
     return 0;
 }
\ No newline at end of file
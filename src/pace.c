@@ -0,0 +1,118 @@
+#include "../include/pace.h"
+#include "../include/stats.h"
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define NS_PER_SECOND 1000000000ull
+
+// Wall clock time cycles take at hz, split so the multiplication cannot overflow.
+static uint64_t cycles_ns(const Pacer* pacer, uint64_t cycles) {
+    return cycles / pacer->hz * NS_PER_SECOND + (cycles % pacer->hz) * NS_PER_SECOND / pacer->hz;
+}
+
+static void sleep_until(uint64_t deadline_ns) {
+#ifndef _WIN32
+    struct timespec deadline = { (time_t) (deadline_ns / NS_PER_SECOND), (long) (deadline_ns % NS_PER_SECOND) };
+    // Only a signal is worth sleeping again for, any other error would fail the same way forever.
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+        ;
+#else
+    uint64_t now = stats_now_ns();
+    if (deadline_ns > now)
+        Sleep((DWORD) ((deadline_ns - now) / 1000000));
+#endif
+}
+
+void pace_init(Pacer* pacer, uint64_t hz, uint32_t burst, PacePolicy policy) {
+    memset(pacer, 0, sizeof(Pacer));
+    pacer->hz = hz;
+    pacer->burst = burst > 0 ? burst : (uint32_t) (hz * PACE_DEFAULT_BURST_NS / NS_PER_SECOND);
+    if (pacer->burst == 0)
+        pacer->burst = 1;
+    pacer->policy = policy;
+    pacer->spin_ns = PACE_DEFAULT_SPIN_NS;
+    pacer->max_lag_ns = PACE_DEFAULT_MAX_LAG_NS;
+}
+
+void pace_start(Pacer* pacer, uint64_t cycle) {
+    pacer->start_ns = stats_now_ns();
+    pacer->start_cycle = cycle;
+}
+
+void pace_wait(Pacer* pacer, uint64_t cycle) {
+    pacer->bursts++;
+    if (pacer->hz == 0) {
+        pace_start(pacer, cycle);
+        return;
+    }
+
+    uint64_t deadline = pacer->start_ns + cycles_ns(pacer, cycle - pacer->start_cycle);
+    uint64_t now = stats_now_ns();
+
+    // Behind schedule, either keep the deadlines and let the next bursts run back to back or move them.
+    if (now >= deadline) {
+        uint64_t lag = now - deadline;
+        uint64_t dropped = pacer->policy == PACE_DROP ? lag : (lag > pacer->max_lag_ns ? lag - pacer->max_lag_ns : 0);
+
+        if (lag > 0) {
+            pacer->late++;
+            pacer->late_sum_ns += (double) lag;
+            if (lag > pacer->late_max_ns)
+                pacer->late_max_ns = lag;
+        }
+        pacer->dropped_ns += dropped;
+        pacer->start_ns += dropped;
+        return;
+    }
+
+    if (deadline - now > pacer->spin_ns) {
+        uint64_t wake = deadline - pacer->spin_ns;
+        sleep_until(wake);
+
+        uint64_t oversleep = (now = stats_now_ns()) > wake ? now - wake : 0;
+        pacer->sleeps++;
+        pacer->overslept += now > deadline;
+        pacer->oversleep_sum_ns += (double) oversleep;
+        if (oversleep > pacer->oversleep_max_ns)
+            pacer->oversleep_max_ns = oversleep;
+    }
+    while ((now = stats_now_ns()) < deadline)
+        ;
+
+    uint64_t jitter = now - deadline;
+    pacer->waits++;
+    pacer->jitter_sum_ns += (double) jitter;
+    pacer->jitter_square_sum_ns += (double) jitter * (double) jitter;
+    if (jitter > pacer->jitter_max_ns)
+        pacer->jitter_max_ns = jitter;
+}
+
+void pace_report(const Pacer* pacer, FILE* out) {
+    if (pacer->hz == 0) {
+        fprintf(out, "Ran unthrottled in %llu bursts.\n", (unsigned long long) pacer->bursts);
+        return;
+    }
+
+    double mean = pacer->waits ? pacer->jitter_sum_ns / (double) pacer->waits : 0.0;
+    double variance = pacer->waits ? pacer->jitter_square_sum_ns / (double) pacer->waits - mean * mean : 0.0;
+
+    fprintf(out, "Paced at %llu Hz in %llu bursts of %u cycles, %llu late, %.3f ms dropped.\n",
+        (unsigned long long) pacer->hz, (unsigned long long) pacer->bursts, pacer->burst,
+        (unsigned long long) pacer->late, (double) pacer->dropped_ns / 1e6);
+    fprintf(out, "Wake jitter: mean %.2f us, stddev %.2f us, max %.2f us over %llu waits.\n",
+        mean / 1e3, sqrt(variance > 0.0 ? variance : 0.0) / 1e3, (double) pacer->jitter_max_ns / 1e3,
+        (unsigned long long) pacer->waits);
+    if (pacer->sleeps > 0)
+        fprintf(out, "Sleep overshoot: mean %.2f us, max %.2f us over %llu sleeps, %llu past the deadline.\n",
+            pacer->oversleep_sum_ns / (double) pacer->sleeps / 1e3, (double) pacer->oversleep_max_ns / 1e3,
+            (unsigned long long) pacer->sleeps, (unsigned long long) pacer->overslept);
+    if (pacer->late > 0)
+        fprintf(out, "Late bursts: mean %.2f us, max %.2f us behind.\n",
+            pacer->late_sum_ns / (double) pacer->late / 1e3, (double) pacer->late_max_ns / 1e3);
+}
@@ -0,0 +1,81 @@
+#include "../include/recomp.h"
+#include "../include/console.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RESET_VECTOR 0xFFFC
+
+// Runs one whole instruction through the interpreter.
+static void interpret(Cpu* cpu) {
+    do {
+        cpu_clock();
+    } while (cpu->cycles > 0);
+}
+
+void recomp_run(const RecompProgram* program) {
+    Cpu* cpu = get_cpu();
+
+    // Let the reset cycles elapse the same way the interpreter does.
+    while (cpu->cycles > 0)
+        cpu_clock();
+
+    while (cpu->pc < program->program_end && !cpu->halted) {
+        // Pending interrupts are taken by the interpreter on the block boundary.
+        if ((atomic_load_explicit(&cpu->interrupt_lines, memory_order_relaxed) & INTERRUPT_PENDING_MASK) && interrupt_pending()) {
+            interpret(cpu);
+            continue;
+        }
+
+        uint32_t offset = (uint32_t) cpu->pc - program->origin;
+
+        if (cpu->pc >= program->origin && offset < program->size) {
+            const RecompBlock* block = program->blocks[offset];
+
+            if (block && memcmp(cpu->bus->ram + block->start, program->image + offset, block->length) == 0) {
+                block->run(cpu);
+                continue;
+            }
+        }
+        interpret(cpu);
+    }
+}
+
+int recomp_main(const RecompProgram* program) {
+    Bus bus;
+    if (!bus_init(&bus))
+        return EXIT_FAILURE;
+
+    for (uint32_t i = 0; i < program->size; i++)
+        bus_write(&bus, program->origin + i, program->image[i]);
+
+    Console console;
+    console_init(&console, &bus, CONSOLE_BASE);
+
+    if (!cpu_init()) {
+        bus_free(&bus);
+        return EXIT_FAILURE;
+    }
+    cpu_connect_bus(&bus);
+
+    if (program->origin + program->size <= RESET_VECTOR) {
+        bus_write(&bus, RESET_VECTOR, (program->origin & 0x00FF));
+        bus_write(&bus, RESET_VECTOR + 1, (program->origin >> 8));
+    }
+
+    cpu_reset();
+    recomp_run(program);
+    console_flush(&console);
+
+    printf("A register = 0x%02x\n", get_cpu()->a);
+    printf("X register = 0x%02x\n", get_cpu()->x);
+    printf("Y register = 0x%02x\n", get_cpu()->y);
+    printf("Staus register = 0x%02x\n", get_cpu()->status);
+    printf("PC = 0x%04x\n", get_cpu()->pc);
+
+    console_free(&console, &bus);
+    cpu_free();
+    bus_free(&bus);
+
+    return 0;
+}
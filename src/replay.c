@@ -0,0 +1,380 @@
+#include "../include/replay.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REPLAY_INITIAL_CAPACITY 0x1000
+
+// FNV-1a over the ram, enough to notice a log being played back against another rom.
+static uint32_t ram_hash(const uint8_t* ram) {
+    uint32_t hash = 0x811C9DC5;
+    for (uint32_t i = 0; i < RAM_SIZE; i++)
+        hash = (hash ^ ram[i]) * 0x01000193;
+    return hash;
+}
+
+static void append_byte(Replay* replay, uint8_t byte) {
+    if (replay->length == replay->capacity) {
+        replay->capacity *= 2;
+        replay->events = realloc(replay->events, replay->capacity);
+        if (!replay->events) {
+            fprintf(stderr, "Unable to grow the replay log.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    replay->events[replay->length++] = byte;
+}
+
+static void append_varint(Replay* replay, uint64_t value) {
+    while (value >= 0x80) {
+        append_byte(replay, (value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    append_byte(replay, value);
+}
+
+static void append_event(Replay* replay, const ReplayEvent* event) {
+    append_varint(replay, event->cycle - replay->event_cycle);
+    append_byte(replay, event->kind);
+    if (event->kind == REPLAY_EVENT_INPUT) {
+        append_byte(replay, event->source);
+        append_byte(replay, event->value);
+    }
+    else if (event->kind == REPLAY_EVENT_BLOCK) {
+        append_byte(replay, event->source);
+        append_varint(replay, event->value);
+        for (uint32_t i = 0; i < event->value; i++)
+            append_byte(replay, event->data[i]);
+    }
+    else
+        append_varint(replay, event->value);
+
+    replay->event_cycle = event->cycle;
+    replay->cursor = replay->length;
+}
+
+static uint64_t read_varint(const Replay* replay, size_t* offset) {
+    uint64_t value = 0;
+    for (int shift = 0; *offset < replay->length && shift < 64; shift += 7) {
+        uint8_t byte = replay->events[(*offset)++];
+        value |= (uint64_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            break;
+    }
+    return value;
+}
+
+// Decodes the event at the cursor, returns the offset just past it or 0 if the log has ended.
+static size_t peek_event(const Replay* replay, ReplayEvent* event) {
+    if (replay->cursor >= replay->length)
+        return 0;
+
+    size_t offset = replay->cursor;
+    event->cycle = replay->event_cycle + read_varint(replay, &offset);
+    event->kind = replay->events[offset++];
+    event->data = NULL;
+    if (event->kind == REPLAY_EVENT_INPUT) {
+        event->source = replay->events[offset++];
+        event->value = replay->events[offset++];
+    }
+    else if (event->kind == REPLAY_EVENT_BLOCK) {
+        event->source = replay->events[offset++];
+        event->value = (uint32_t) read_varint(replay, &offset);
+        // A truncated block ends the log.
+        if (event->value > replay->length - offset)
+            return 0;
+        event->data = replay->events + offset;
+        offset += event->value;
+    }
+    else {
+        event->source = 0;
+        event->value = (uint32_t) read_varint(replay, &offset);
+    }
+    return offset;
+}
+
+static void consume_event(Replay* replay, const ReplayEvent* event, size_t next) {
+    replay->event_cycle = event->cycle;
+    replay->cursor = next;
+}
+
+static void report_divergence(Replay* replay, const char* what) {
+    if (!replay->diverged)
+        fprintf(stderr, "Replay diverged at cycle %llu: %s.\n", (unsigned long long) replay->cpu->clock_count, what);
+    replay->diverged = true;
+}
+
+static void take_snapshot(Replay* replay) {
+    if (replay->snapshot_count == REPLAY_MAX_SNAPSHOTS) {
+        // Keep the first one and every other one after it, then space them twice as far apart.
+        free(replay->snapshots[1].ram);
+        size_t kept = 1;
+        for (size_t i = 2; i < replay->snapshot_count; i++) {
+            if (i % 2 == 0)
+                replay->snapshots[kept++] = replay->snapshots[i];
+            else
+                free(replay->snapshots[i].ram);
+        }
+        replay->snapshot_count = kept;
+        replay->snapshot_interval *= 2;
+    }
+
+    Cpu* cpu = replay->cpu;
+    ReplaySnapshot* snapshot = &replay->snapshots[replay->snapshot_count++];
+
+    memcpy(&snapshot->cpu, cpu, sizeof(Cpu));
+    snapshot->bus = *cpu->bus;
+    snapshot->ram = malloc(RAM_SIZE);
+    if (!snapshot->ram) {
+        fprintf(stderr, "Unable to allocate memory for a replay snapshot.\n");
+        exit(EXIT_FAILURE);
+    }
+    memcpy(snapshot->ram, cpu->bus->ram, RAM_SIZE);
+    snapshot->cursor = replay->cursor;
+    snapshot->event_cycle = replay->event_cycle;
+    snapshot->lines = replay->lines;
+
+    replay->next_snapshot = cpu->clock_count + replay->snapshot_interval;
+}
+
+static void restore_snapshot(Replay* replay, const ReplaySnapshot* snapshot) {
+    Cpu* cpu = replay->cpu;
+    Bus* bus = cpu->bus;
+    uint8_t* ram = bus->ram;
+
+    *bus = snapshot->bus;
+    bus->ram = ram;
+    memcpy(ram, snapshot->ram, RAM_SIZE);
+
+    memcpy(cpu, &snapshot->cpu, sizeof(Cpu));
+    cpu->bus = bus;
+    cpu->replay = replay;
+    atomic_store_explicit(&cpu->interrupt_lines, snapshot->lines, memory_order_relaxed);
+
+    replay->cursor = snapshot->cursor;
+    replay->event_cycle = snapshot->event_cycle;
+    replay->lines = snapshot->lines;
+    replay->next_snapshot = cpu->clock_count + replay->snapshot_interval;
+}
+
+// The latest snapshot taken at or before the cycle, NULL if the cycle is before the first one.
+static const ReplaySnapshot* nearest_snapshot(const Replay* replay, uint64_t cycle) {
+    const ReplaySnapshot* nearest = NULL;
+    for (size_t i = 0; i < replay->snapshot_count && replay->snapshots[i].cpu.clock_count <= cycle; i++)
+        nearest = &replay->snapshots[i];
+    return nearest;
+}
+
+static Replay* replay_create(Cpu* cpu, ReplayMode mode) {
+    Replay* replay = malloc(sizeof(Replay));
+    memset(replay, 0, sizeof(Replay));
+
+    replay->mode = mode;
+    replay->cpu = cpu;
+    replay->ram_hash = ram_hash(cpu->bus->ram);
+    replay->capacity = REPLAY_INITIAL_CAPACITY;
+    replay->events = malloc(replay->capacity);
+    replay->lines = atomic_load_explicit(&cpu->interrupt_lines, memory_order_relaxed);
+    replay->snapshots = malloc(sizeof(ReplaySnapshot) * REPLAY_MAX_SNAPSHOTS);
+    replay->snapshot_interval = REPLAY_SNAPSHOT_INTERVAL;
+
+    if (!replay->events || !replay->snapshots) {
+        fprintf(stderr, "Unable to allocate memory for the replay log.\n");
+        exit(EXIT_FAILURE);
+    }
+    return replay;
+}
+
+Replay* replay_record(Cpu* cpu) {
+    Replay* replay = replay_create(cpu, REPLAY_RECORD);
+
+    take_snapshot(replay);
+    cpu->replay = replay;
+    return replay;
+}
+
+Replay* replay_load(Cpu* cpu, const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Unable to open replay '%s'.\n", path);
+        return NULL;
+    }
+
+    uint32_t header[3];
+    uint64_t length;
+    if (fread(header, sizeof(header), 1, file) != 1 || fread(&length, sizeof(length), 1, file) != 1
+        || header[0] != REPLAY_MAGIC || header[1] != REPLAY_VERSION) {
+        fprintf(stderr, "'%s' is not a replay.\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    Replay* replay = replay_create(cpu, REPLAY_PLAY);
+    if (header[2] != replay->ram_hash)
+        fprintf(stderr, "Replay '%s' was recorded with a different rom, it will likely diverge.\n", path);
+
+    while (replay->capacity < length)
+        replay->capacity *= 2;
+    replay->events = realloc(replay->events, replay->capacity);
+    if (!replay->events || fread(replay->events, 1, length, file) != length) {
+        fprintf(stderr, "Replay '%s' is truncated.\n", path);
+        fclose(file);
+        replay->cpu = NULL;
+        replay_free(replay);
+        return NULL;
+    }
+    replay->length = length;
+    fclose(file);
+
+    take_snapshot(replay);
+    cpu->replay = replay;
+    return replay;
+}
+
+bool replay_save(const Replay* replay, const char* path) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Unable to open replay '%s' for writing.\n", path);
+        return false;
+    }
+
+    // Written in host byte order, replays move between runs on the same machine.
+    uint32_t header[3] = { REPLAY_MAGIC, REPLAY_VERSION, replay->ram_hash };
+    uint64_t length = replay->length;
+    bool written = fwrite(header, sizeof(header), 1, file) == 1 && fwrite(&length, sizeof(length), 1, file) == 1
+        && fwrite(replay->events, 1, replay->length, file) == replay->length;
+
+    fclose(file);
+    if (!written)
+        fprintf(stderr, "Unable to write replay '%s'.\n", path);
+    return written;
+}
+
+void replay_free(Replay* replay) {
+    if (!replay)
+        return;
+
+    if (replay->cpu && replay->cpu->replay == replay)
+        replay->cpu->replay = NULL;
+    for (size_t i = 0; i < replay->snapshot_count; i++)
+        free(replay->snapshots[i].ram);
+    free(replay->snapshots);
+    free(replay->events);
+    free(replay);
+}
+
+bool replay_playing(const Replay* replay) {
+    return replay->cursor < replay->length;
+}
+
+uint32_t replay_interrupts(Replay* replay, uint32_t lines) {
+    Cpu* cpu = replay->cpu;
+
+    // Snapshots are only taken on instruction boundaries, before the events of that cycle are applied.
+    if (cpu->clock_count >= replay->next_snapshot
+        && cpu->clock_count > replay->snapshots[replay->snapshot_count - 1].cpu.clock_count)
+        take_snapshot(replay);
+
+    if (replay_playing(replay)) {
+        ReplayEvent event;
+        size_t next;
+
+        while ((next = peek_event(replay, &event)) && event.kind == REPLAY_EVENT_INTERRUPTS && event.cycle <= cpu->clock_count) {
+            if (event.cycle != cpu->clock_count)
+                report_divergence(replay, "interrupt lines logged between instruction boundaries");
+            replay->lines = event.value;
+            consume_event(replay, &event, next);
+        }
+
+        // The cpu clears NMI_PENDING in the word itself, so it is rewritten on every boundary.
+        atomic_store_explicit(&cpu->interrupt_lines, replay->lines, memory_order_relaxed);
+        return replay->lines;
+    }
+
+    if (replay->mode == REPLAY_RECORD && lines != replay->lines) {
+        ReplayEvent event = { cpu->clock_count, REPLAY_EVENT_INTERRUPTS, 0, lines };
+        append_event(replay, &event);
+        replay->lines = lines;
+    }
+    return lines;
+}
+
+uint8_t replay_input(Replay* replay, uint8_t source, uint8_t value) {
+    if (replay_playing(replay)) {
+        ReplayEvent event;
+        size_t next = peek_event(replay, &event);
+
+        if (event.kind != REPLAY_EVENT_INPUT || event.source != source) {
+            report_divergence(replay, "input read that is not in the log");
+            return value;
+        }
+        if (event.cycle != replay->cpu->clock_count)
+            report_divergence(replay, "input read on another cycle than logged");
+
+        consume_event(replay, &event, next);
+        return event.value;
+    }
+
+    if (replay->mode == REPLAY_RECORD) {
+        ReplayEvent event = { replay->cpu->clock_count, REPLAY_EVENT_INPUT, source, value };
+        append_event(replay, &event);
+    }
+    return value;
+}
+
+const uint8_t* replay_input_block(Replay* replay, uint8_t source, const uint8_t* data, uint32_t length) {
+    if (replay_playing(replay)) {
+        ReplayEvent event;
+        size_t next = peek_event(replay, &event);
+
+        if (!next || event.kind != REPLAY_EVENT_BLOCK || event.source != source || event.value != length) {
+            report_divergence(replay, "input transfer that is not in the log");
+            return data;
+        }
+        if (event.cycle != replay->cpu->clock_count)
+            report_divergence(replay, "input transfer on another cycle than logged");
+
+        consume_event(replay, &event, next);
+        return event.data;
+    }
+
+    if (replay->mode == REPLAY_RECORD) {
+        ReplayEvent event = { replay->cpu->clock_count, REPLAY_EVENT_BLOCK, source, length, data };
+        append_event(replay, &event);
+    }
+    return data;
+}
+
+bool replay_seek(Replay* replay, uint64_t cycle) {
+    Cpu* cpu = replay->cpu;
+    const ReplaySnapshot* snapshot = nearest_snapshot(replay, cycle);
+
+    if (cycle < cpu->clock_count || (snapshot && snapshot->cpu.clock_count > cpu->clock_count)) {
+        if (!snapshot)
+            return false;
+        restore_snapshot(replay, snapshot);
+    }
+
+    while (cpu->clock_count < cycle)
+        cpu_clock();
+    return true;
+}
+
+bool replay_step_back(Replay* replay) {
+    Cpu* cpu = replay->cpu;
+    uint64_t now = cpu->clock_count;
+
+    if (now == 0 || !nearest_snapshot(replay, now - 1))
+        return false;
+
+    // Walk forward from the snapshot to find where the last instruction before now started.
+    restore_snapshot(replay, nearest_snapshot(replay, now - 1));
+    uint64_t start = cpu->clock_count;
+    while (cpu->clock_count < now) {
+        if (cpu->cycles == 0)
+            start = cpu->clock_count;
+        cpu_clock();
+    }
+
+    return replay_seek(replay, start);
+}
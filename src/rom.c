@@ -0,0 +1,36 @@
+#include "../include/rom.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool rom_is_hex(const char* filepath) {
+    size_t length = strlen(filepath);
+    return length >= 4 && strcmp(filepath + length - 4, ".txt") == 0;
+}
+
+bool rom_is_source(const char* filepath) {
+    size_t length = strlen(filepath);
+    return (length >= 2 && strcmp(filepath + length - 2, ".s") == 0)
+        || (length >= 4 && strcmp(filepath + length - 4, ".asm") == 0);
+}
+
+long rom_read(const char* filepath, bool hex, uint8_t* buf, size_t size) {
+    FILE* file = fopen(filepath, hex ? "r" : "rb");
+    if (!file) {
+        fprintf(stderr, "Unable to open rom file '%s'.\n", filepath);
+        return -1;
+    }
+
+    long count = 0;
+    if (hex) {
+        char token[16];
+        while (count < (long) size && fscanf(file, "%15s", token) == 1)
+            buf[count++] = (uint8_t) strtol(token, NULL, 0);
+    }
+    else {
+        count = (long) fread(buf, 1, size, file);
+    }
+
+    fclose(file);
+    return count;
+}
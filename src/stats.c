@@ -0,0 +1,159 @@
+#include "../include/stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#define STATS_READ_RETRIES 100
+
+const char* stats_directory() {
+    const char* dir = getenv(STATS_DIR_ENV);
+    return dir ? dir : STATS_DEFAULT_DIR;
+}
+
+uint64_t stats_now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+#ifndef _WIN32
+
+StatsPublisher* stats_open(const char* name) {
+    StatsPublisher* publisher = malloc(sizeof(StatsPublisher));
+    if (!publisher) {
+        fprintf(stderr, "Unable to allocate memory for the stats publisher.\n");
+        return NULL;
+    }
+    snprintf(publisher->path, sizeof(publisher->path), "%s/%s%d", stats_directory(), STATS_FILE_PREFIX, (int) getpid());
+
+    int fd = open(publisher->path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, sizeof(StatsBlock)) != 0) {
+        fprintf(stderr, "Unable to create stats file '%s'.\n", publisher->path);
+        if (fd >= 0)
+            close(fd);
+        free(publisher);
+        return NULL;
+    }
+
+    publisher->block = mmap(NULL, sizeof(StatsBlock), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (publisher->block == MAP_FAILED) {
+        fprintf(stderr, "Unable to map stats file '%s'.\n", publisher->path);
+        unlink(publisher->path);
+        free(publisher);
+        return NULL;
+    }
+
+    StatsBlock* block = publisher->block;
+    memset(block, 0, sizeof(StatsBlock));
+    block->version = STATS_VERSION;
+    block->pid = (int32_t) getpid();
+    snprintf(block->name, sizeof(block->name), "%s", name);
+    block->start_ns = stats_now_ns();
+    block->update_ns = block->start_ns;
+
+    publisher->last_ns = block->start_ns;
+    publisher->last_cycles = 0;
+    publisher->next_instructions = STATS_PUBLISH_INTERVAL;
+
+    // Readers ignore the block until the magic shows up.
+    atomic_thread_fence(memory_order_release);
+    block->magic = STATS_MAGIC;
+    return publisher;
+}
+
+void stats_publish(StatsPublisher* publisher, const Cpu* cpu, const Bus* bus) {
+    StatsBlock* block = publisher->block;
+    uint64_t now = stats_now_ns();
+    uint32_t sequence = atomic_load_explicit(&block->sequence, memory_order_relaxed);
+
+    atomic_store_explicit(&block->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    block->update_ns = now;
+    if (now > publisher->last_ns)
+        block->hz = (cpu->clock_count - publisher->last_cycles) * 1000000000ull / (now - publisher->last_ns);
+
+    block->counters.instructions = cpu->instruction_count;
+    block->counters.cycles = cpu->clock_count;
+    block->counters.interrupts = cpu->interrupt_count;
+    block->counters.illegal = cpu->illegal_count;
+    block->counters.bus_reads = bus->read_count;
+    block->counters.bus_writes = bus->write_count;
+    block->counters.mmio_callbacks = bus->mmio_count;
+
+    atomic_store_explicit(&block->sequence, sequence + 2, memory_order_release);
+
+    publisher->last_ns = now;
+    publisher->last_cycles = cpu->clock_count;
+    publisher->next_instructions = cpu->instruction_count + STATS_PUBLISH_INTERVAL;
+}
+
+void stats_close(StatsPublisher* publisher) {
+    if (!publisher)
+        return;
+
+    munmap(publisher->block, sizeof(StatsBlock));
+    unlink(publisher->path);
+    free(publisher);
+}
+
+bool stats_read(const char* path, StatsBlock* sample) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    if (lseek(fd, 0, SEEK_END) < (off_t) sizeof(StatsBlock)) {
+        close(fd);
+        return false;
+    }
+
+    StatsBlock* block = mmap(NULL, sizeof(StatsBlock), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (block == MAP_FAILED)
+        return false;
+
+    bool valid = false;
+    for (int i = 0; i < STATS_READ_RETRIES && block->magic == STATS_MAGIC; i++) {
+        uint32_t before = atomic_load_explicit(&block->sequence, memory_order_acquire);
+        if (before & 1)
+            continue;
+
+        memcpy(sample, block, sizeof(StatsBlock));
+        atomic_thread_fence(memory_order_acquire);
+
+        if (atomic_load_explicit(&block->sequence, memory_order_relaxed) == before) {
+            valid = sample->version == STATS_VERSION;
+            break;
+        }
+    }
+
+    munmap(block, sizeof(StatsBlock));
+    return valid;
+}
+
+#else
+
+StatsPublisher* stats_open(const char* name) {
+    fprintf(stderr, "Stats publishing is not supported on this platform.\n");
+    return NULL;
+}
+
+void stats_publish(StatsPublisher* publisher, const Cpu* cpu, const Bus* bus) {
+}
+
+void stats_close(StatsPublisher* publisher) {
+}
+
+bool stats_read(const char* path, StatsBlock* sample) {
+    return false;
+}
+
+#endif
@@ -0,0 +1,258 @@
+#include "../include/system.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#define MAILBOX_REGISTER_MASK 0x0001
+#define MAILBOX_INDEX_MASK (SYSTEM_MAILBOX_SIZE - 1)
+
+static uint8_t shared_read(void* device, uint16_t address) {
+    SharedRam* shared = device;
+    return atomic_load_explicit(&shared->memory[address - shared->base], memory_order_acquire);
+}
+
+static void shared_write(void* device, uint16_t address, uint8_t data) {
+    SharedRam* shared = device;
+    atomic_store_explicit(&shared->memory[address - shared->base], data, memory_order_release);
+}
+
+// Reading shared ram or a status register changes nothing.
+static bool shared_quiet(void* device, uint16_t address) {
+    return true;
+}
+
+static bool mailbox_receiver_quiet(void* device, uint16_t address) {
+    return (address & MAILBOX_REGISTER_MASK) == MAILBOX_STATUS;
+}
+
+static uint8_t mailbox_sender_read(void* device, uint16_t address) {
+    Mailbox* mailbox = device;
+    if ((address & MAILBOX_REGISTER_MASK) != MAILBOX_STATUS)
+        return 0x00;
+
+    uint32_t head = atomic_load_explicit(&mailbox->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&mailbox->tail, memory_order_acquire);
+    return (head - tail < SYSTEM_MAILBOX_SIZE) ? MAILBOX_STATUS_READY : 0x00;
+}
+
+static void mailbox_sender_write(void* device, uint16_t address, uint8_t data) {
+    Mailbox* mailbox = device;
+    if ((address & MAILBOX_REGISTER_MASK) != MAILBOX_DATA)
+        return;
+
+    uint32_t head = atomic_load_explicit(&mailbox->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&mailbox->tail, memory_order_acquire);
+    if (head - tail == SYSTEM_MAILBOX_SIZE)
+        return;
+
+    mailbox->data[head & MAILBOX_INDEX_MASK] = data;
+    atomic_store_explicit(&mailbox->head, head + 1, memory_order_release);
+}
+
+static uint8_t mailbox_receiver_read(void* device, uint16_t address) {
+    Mailbox* mailbox = device;
+    uint32_t tail = atomic_load_explicit(&mailbox->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&mailbox->head, memory_order_acquire);
+
+    if ((address & MAILBOX_REGISTER_MASK) == MAILBOX_STATUS)
+        return (head != tail) ? MAILBOX_STATUS_READY : 0x00;
+    if (head == tail)
+        return 0x00;
+
+    uint8_t data = mailbox->data[tail & MAILBOX_INDEX_MASK];
+    atomic_store_explicit(&mailbox->tail, tail + 1, memory_order_release);
+    return data;
+}
+
+static void mailbox_receiver_write(void* device, uint16_t address, uint8_t data) {
+}
+
+void system_init(System* system) {
+    memset(system, 0, sizeof(System));
+    system->quantum = SYSTEM_DEFAULT_QUANTUM;
+    system->skip_idle = true;
+    atomic_init(&system->stop, false);
+}
+
+void system_free(System* system) {
+    for (size_t i = 0; i < system->cpu_count; i++) {
+        for (size_t j = 0; j < system->shared_count; j++)
+            bus_unmap(system->cpus[i].bus, &system->shared[j].device);
+        for (size_t j = 0; j < system->mailbox_count; j++) {
+            bus_unmap(system->cpus[i].bus, &system->mailboxes[j].sender);
+            bus_unmap(system->cpus[i].bus, &system->mailboxes[j].receiver);
+        }
+    }
+    for (size_t i = 0; i < system->shared_count; i++)
+        free((void*) system->shared[i].memory);
+    system->shared_count = 0;
+    system->mailbox_count = 0;
+}
+
+int system_add_cpu(System* system, Cpu* cpu, uint32_t stop_pc) {
+    if (system->cpu_count == SYSTEM_MAX_CPUS)
+        return -1;
+
+    SystemCpu* entry = &system->cpus[system->cpu_count];
+    entry->cpu = cpu;
+    entry->bus = cpu->bus;
+    entry->stop_pc = stop_pc;
+    idle_init(&entry->idle);
+    return (int) system->cpu_count++;
+}
+
+bool system_share(System* system, uint16_t address, uint16_t pages) {
+    if (system->shared_count == SYSTEM_MAX_SHARED)
+        return false;
+
+    SharedRam* shared = &system->shared[system->shared_count++];
+    shared->base = address & ~(uint16_t)((1 << BUS_PAGE_SHIFT) - 1);
+    shared->memory = calloc((size_t) pages << BUS_PAGE_SHIFT, sizeof(uint8_t));
+    if (!shared->memory) {
+        fprintf(stderr, "Unable to allocate memory for shared ram.\n");
+        exit(EXIT_FAILURE);
+    }
+    shared->device.read = &shared_read;
+    shared->device.write = &shared_write;
+    shared->device.device = shared;
+    shared->device.quiet = &shared_quiet;
+
+    for (size_t i = 0; i < system->cpu_count; i++)
+        bus_map(system->cpus[i].bus, shared->base, pages, &shared->device);
+    return true;
+}
+
+bool system_connect(System* system, int from, int to, uint16_t address) {
+    if (system->mailbox_count == SYSTEM_MAX_MAILBOXES || from < 0 || to < 0
+        || from >= (int) system->cpu_count || to >= (int) system->cpu_count || from == to)
+        return false;
+
+    Mailbox* mailbox = &system->mailboxes[system->mailbox_count++];
+    atomic_init(&mailbox->head, 0);
+    atomic_init(&mailbox->tail, 0);
+    mailbox->sender = (BusDevice) { &mailbox_sender_read, &mailbox_sender_write, mailbox, &shared_quiet, NULL };
+    mailbox->receiver = (BusDevice) { &mailbox_receiver_read, &mailbox_receiver_write, mailbox, &mailbox_receiver_quiet, NULL };
+
+    bus_map(system->cpus[from].bus, address, 1, &mailbox->sender);
+    bus_map(system->cpus[to].bus, address, 1, &mailbox->receiver);
+    return true;
+}
+
+static bool cpu_done(const SystemCpu* entry) {
+    return entry->cpu->pc >= entry->stop_pc || entry->cpu->halted;
+}
+
+// Runs the selected cpu for up to a quantum, stopping early on an instruction boundary once it is done.
+static void run_quantum(const System* system, SystemCpu* entry) {
+    Cpu* cpu = entry->cpu;
+    uint64_t end = cpu->clock_count + system->quantum;
+
+    while (cpu->clock_count < end) {
+        if (cpu->cycles == 0 && cpu_done(entry))
+            return;
+
+        uint16_t pc = cpu->pc;
+        if (cpu_clock() && system->skip_idle && cpu->pc <= pc)
+            idle_check(&entry->idle, cpu, end);
+    }
+}
+
+// Waits for the wall clock once the primary has run another burst.
+static void pace_primary(System* system, uint64_t* next_burst) {
+    const Cpu* primary = system->cpus[0].cpu;
+
+    if (system->pacer && primary->clock_count >= *next_burst) {
+        pace_wait(system->pacer, primary->clock_count);
+        *next_burst = primary->clock_count + system->pacer->burst;
+    }
+}
+
+static void publish_primary(System* system) {
+    const Cpu* primary = system->cpus[0].cpu;
+
+    if (system->stats && primary->instruction_count >= system->stats->next_instructions)
+        stats_publish(system->stats, primary, system->cpus[0].bus);
+}
+
+static uint64_t start_pacing(System* system) {
+    if (!system->pacer)
+        return 0;
+
+    pace_start(system->pacer, system->cpus[0].cpu->clock_count);
+    return system->cpus[0].cpu->clock_count + system->pacer->burst;
+}
+
+void system_run(System* system) {
+    Cpu* selected = get_cpu();
+    uint64_t next_burst = system->cpu_count > 0 ? start_pacing(system) : 0;
+
+    while (system->cpu_count > 0 && !cpu_done(&system->cpus[0])) {
+        for (size_t i = 0; i < system->cpu_count; i++) {
+            cpu_select(system->cpus[i].cpu);
+            run_quantum(system, &system->cpus[i]);
+        }
+        publish_primary(system);
+        pace_primary(system, &next_burst);
+    }
+    cpu_select(selected);
+}
+
+#ifndef _WIN32
+
+typedef struct {
+    System* system;
+    size_t index;
+} SystemThread;
+
+static void* run_thread(void* argument) {
+    SystemThread* thread = argument;
+    System* system = thread->system;
+    SystemCpu* entry = &system->cpus[thread->index];
+    uint64_t next_burst = thread->index == 0 ? start_pacing(system) : 0;
+
+    cpu_select(entry->cpu);
+    while (!atomic_load_explicit(&system->stop, memory_order_relaxed)) {
+        run_quantum(system, entry);
+        if (thread->index == 0) {
+            publish_primary(system);
+            pace_primary(system, &next_burst);
+        }
+
+        // The primary decides when the system is done, the others serve it until then or until they are done themselves.
+        if (cpu_done(entry)) {
+            if (thread->index == 0)
+                atomic_store_explicit(&system->stop, true, memory_order_relaxed);
+            break;
+        }
+    }
+    return NULL;
+}
+
+void system_run_threaded(System* system) {
+    pthread_t threads[SYSTEM_MAX_CPUS];
+    SystemThread arguments[SYSTEM_MAX_CPUS];
+
+    atomic_store(&system->stop, false);
+    for (size_t i = 0; i < system->cpu_count; i++) {
+        arguments[i] = (SystemThread) { system, i };
+        if (pthread_create(&threads[i], NULL, &run_thread, &arguments[i]) != 0) {
+            fprintf(stderr, "Unable to start a thread for cpu %zu.\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (size_t i = 0; i < system->cpu_count; i++)
+        pthread_join(threads[i], NULL);
+}
+
+#else
+
+void system_run_threaded(System* system) {
+    fprintf(stderr, "Threaded systems are not supported on this platform, running interleaved.\n");
+    system_run(system);
+}
+
+#endif
@@ -0,0 +1,169 @@
+; Bruce Clark's decimal mode test, as adapted by Klaus Dormann, for asm6502. Only valid BCD operands
+; are tried and only the accumulator and carry are checked, which every part with decimal mode
+; agrees on. Runs from $0200 and ends in a jump to itself with ERROR at $000B zero if it passed.
+
+n1 = $00                ; first operand
+n2 = $01                ; second operand
+ha = $02                ; binary accumulator result
+hnvzc = $03             ; binary flags result
+da = $04                ; decimal accumulator result
+dnvzc = $05             ; decimal flags result
+ar = $06                ; predicted accumulator
+nf = $07                ; predicted flags
+vf = $08
+zf = $09
+cf = $0A
+error = $0B             ; 0 when the test passed
+n1l = $0C               ; n1 & $0F
+n1h = $0D               ; n1 & $F0
+n2l = $0E               ; n2 & $0F
+n2h = $0F               ; n2 & $F0, then n2 & $F0 | $0F at n2h + 1
+
+        .org $0200
+test:   ldy #1          ; y runs through both values of the carry
+        sty error       ; 1 until the test passes
+        lda #0
+        sta n1
+        sta n2
+loop1:  lda n2
+        and #$0F
+        cmp #$0A
+        bcs next2
+        sta n2l
+        lda n2
+        and #$F0
+        cmp #$A0
+        bcs next2
+        sta n2h
+        ora #$0F
+        sta n2h + 1
+loop2:  lda n1
+        and #$0F
+        cmp #$0A
+        bcs next1
+        sta n1l
+        lda n1
+        and #$F0
+        cmp #$A0
+        bcs next1
+        sta n1h
+        jsr add
+        jsr a6502
+        jsr compare
+        bne done
+        jsr sub
+        jsr s6502
+        jsr compare
+        bne done
+next1:  inc n1
+        bne loop2       ; every value of n1
+next2:  inc n2
+        bne loop1       ; every value of n2
+        dey
+        bpl loop1       ; both values of the carry
+        lda #0
+        sta error
+done:   jmp done
+
+; The actual decimal and binary results of n1 + n2, and the predicted accumulator and carry.
+add:    sed
+        cpy #1          ; carry set when y is 1
+        lda n1
+        adc n2
+        sta da
+        php
+        pla
+        sta dnvzc
+        cld
+        cpy #1
+        lda n1
+        adc n2
+        sta ha
+        php
+        pla
+        sta hnvzc
+        cpy #1
+        lda n1l
+        adc n2l
+        cmp #$0A
+        ldx #0
+        bcc a1
+        inx
+        adc #5          ; add 6, the carry is set
+        and #$0F
+        sec
+a1:     ora n1h
+        adc n2h,x       ; n2 & $F0, or that plus $10 with the carry when the low digit carried
+        php
+        bcs a2
+        cmp #$A0
+        bcc a3
+a2:     adc #$5F        ; add $60, the carry is set
+        sec
+a3:     sta ar
+        php
+        pla
+        sta cf
+        pla
+        sta vf          ; all of p, bit 7 is the predicted n
+        rts
+
+; The actual decimal and binary results of n1 - n2.
+sub:    sed
+        cpy #1
+        lda n1
+        sbc n2
+        sta da
+        php
+        pla
+        sta dnvzc
+        cld
+        cpy #1
+        lda n1
+        sbc n2
+        sta ha
+        php
+        pla
+        sta hnvzc
+        rts
+
+; The predicted accumulator of n1 - n2.
+sub1:   cpy #1
+        lda n1l
+        sbc n2l
+        ldx #0
+        bcs s11
+        inx
+        sbc #5          ; subtract 6, the carry is clear
+        and #$0F
+        clc
+s11:    ora n1h
+        sbc n2h,x       ; n2 & $F0, or that plus $10 with the borrow when the low digit borrowed
+        bcs s12
+        sbc #$5F        ; subtract $60, the carry is clear
+s12:    sta ar
+        rts
+
+; Z set when the accumulator and carry match the prediction.
+compare:
+        lda da
+        cmp ar
+        bne c1
+        lda dnvzc
+        eor cf
+        and #1          ; only the carry
+c1:     rts
+
+a6502:  lda vf
+        sta nf
+        lda hnvzc
+        sta zf
+        rts
+
+s6502:  jsr sub1
+        lda hnvzc
+        sta nf
+        sta vf
+        sta zf
+        sta cf
+        rts
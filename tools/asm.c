@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "../include/asm.h"
+#include "../include/bus.h"
+
+static void usage() {
+    fprintf(stderr,
+        "usage: asm6502 [options] file\n"
+        "  -o file         write the binary here (default the source name with .bin)\n"
+        "  -r start:end    write this range instead of the section holding the first byte\n");
+    exit(EXIT_FAILURE);
+}
+
+static char* read_source(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "Unable to open source file '%s'.\n", path);
+        return NULL;
+    }
+
+    fseek(file, 0L, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0L, SEEK_SET);
+
+    char* text = length >= 0 ? malloc((size_t) length + 1) : NULL;
+    if (text)
+        text[fread(text, 1, (size_t) length, file)] = '\0';
+    else
+        fprintf(stderr, "Unable to allocate memory for '%s'.\n", path);
+    fclose(file);
+    return text;
+}
+
+int main(int argc, char* argv[]) {
+    const char* output_path = NULL;
+    long range_start = -1, range_end = -1;
+    int option;
+
+    while ((option = getopt(argc, argv, "o:r:")) != -1) {
+        switch (option) {
+        case 'o': output_path = optarg; break;
+        case 'r': {
+            char* separator = strchr(optarg, ':');
+            if (!separator)
+                usage();
+            range_start = strtol(optarg, NULL, 0);
+            range_end = strtol(separator + 1, NULL, 0);
+            if (range_start < 0 || range_end <= range_start || range_end > RAM_SIZE)
+                usage();
+            break;
+        }
+        default: usage();
+        }
+    }
+    if (optind >= argc)
+        usage();
+
+    char* source = read_source(argv[optind]);
+    if (!source)
+        exit(EXIT_FAILURE);
+
+    Bus bus;
+    if (!bus_init(&bus))
+        exit(EXIT_FAILURE);
+    AsmResult result;
+    bool assembled = asm_assemble(&bus, source, &result);
+    free(source);
+    if (!assembled) {
+        fprintf(stderr, "%s:%d: %s\n", argv[optind], result.error_line, result.error);
+        exit(EXIT_FAILURE);
+    }
+
+    // An end of 0 is a section that runs up to the top of memory.
+    if (range_start < 0) {
+        range_start = result.start;
+        range_end = result.end > result.start ? result.end : RAM_SIZE;
+    }
+
+    char default_path[FILENAME_MAX];
+    if (!output_path) {
+        snprintf(default_path, sizeof(default_path), "%s", argv[optind]);
+        char* extension = strrchr(default_path, '.');
+        if (extension)
+            *extension = '\0';
+        strncat(default_path, ".bin", sizeof(default_path) - strlen(default_path) - 1);
+        output_path = default_path;
+    }
+
+    FILE* output = fopen(output_path, "wb");
+    if (!output) {
+        fprintf(stderr, "Unable to open '%s' for writing.\n", output_path);
+        exit(EXIT_FAILURE);
+    }
+    size_t size = (size_t)(range_end - range_start);
+    bool written = fwrite(bus.ram + range_start, 1, size, output) == size;
+    if (fclose(output) != 0 || !written) {
+        fprintf(stderr, "Unable to write '%s'.\n", output_path);
+        exit(EXIT_FAILURE);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,558 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <getopt.h>
+#include "../include/bus.h"
+#include "../include/cpu.h"
+#include "../include/stats.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#define OPCODES 0x100
+#define MAX_JOBS (OPCODES + 2)
+#define MAX_RAM_ENTRIES 32
+#define MAX_NAME 32
+#define MAX_FAILURE 192
+
+#define FUNCTIONAL_LOAD 0x0000   // The functional test binary is a whole memory image.
+#define FUNCTIONAL_START 0x0400
+#define FUNCTIONAL_SUCCESS 0x3469
+#define DECIMAL_START 0x0200
+#define DECIMAL_ERROR 0x000B
+
+// Whole program tests trap in a jump to themselves long before this many cycles.
+#define PROGRAM_CYCLE_LIMIT 200000000ull
+
+// The unused and break bits only exist in the copies pushed on the stack, so the register itself is compared without them.
+#define STATUS_MASK ((uint8_t) ~(U | B))
+
+static void usage() {
+    fprintf(stderr,
+        "usage: conform6502 [options] [vectors]\n"
+        "  vectors         directory of SingleStepTests files, 00.json to ff.json\n"
+        "  -f file         Klaus Dormann's functional test binary, loaded at 0 and run from 0x0400\n"
+        "  -s address      address the functional test traps at on success (default 0x3469)\n"
+        "  -d file         decimal mode test binary, loaded and run at 0x0200, passes when ERROR at 0x000b is 0\n"
+        "  -j jobs         files tested at once (default one per core)\n"
+        "  -q              only print the matrix when something failed\n");
+    exit(EXIT_FAILURE);
+}
+
+typedef enum {
+    JOB_VECTORS,
+    JOB_FUNCTIONAL,
+    JOB_DECIMAL,
+} JobKind;
+
+typedef struct {
+    JobKind kind;
+    uint8_t opcode;
+    char path[512];
+
+    // Written only by the thread running the job.
+    bool found;
+    uint64_t passed;
+    uint64_t failed;
+    char failure[MAX_FAILURE];
+} Job;
+
+typedef struct {
+    Job jobs[MAX_JOBS];
+    size_t job_count;
+    _Atomic size_t next_job;
+    uint16_t functional_success;
+} Suite;
+
+// Just enough JSON for the single step files, which are an array of flat test objects.
+typedef struct {
+    const char* p;
+    const char* end;
+    bool error;
+} Json;
+
+typedef struct {
+    uint16_t pc;
+    uint8_t s, a, x, y, p;
+    size_t ram_count;
+    uint16_t ram_address[MAX_RAM_ENTRIES];
+    uint8_t ram_data[MAX_RAM_ENTRIES];
+} StepState;
+
+static void json_space(Json* json) {
+    while (json->p < json->end && (*json->p == ' ' || *json->p == '\n' || *json->p == '\r' || *json->p == '\t'))
+        json->p++;
+}
+
+static bool json_peek(Json* json, char c) {
+    json_space(json);
+    return json->p < json->end && *json->p == c;
+}
+
+static void json_expect(Json* json, char c) {
+    if (json_peek(json, c))
+        json->p++;
+    else
+        json->error = true;
+}
+
+// Consumes a comma and reports whether another element follows, or the closing bracket and reports the end.
+static bool json_next(Json* json, char close) {
+    if (json_peek(json, ',')) {
+        json->p++;
+        return true;
+    }
+    json_expect(json, close);
+    return false;
+}
+
+static long json_number(Json* json) {
+    json_space(json);
+    char* end;
+    long value = strtol(json->p, &end, 10);
+    if (end == json->p)
+        json->error = true;
+    json->p = end;
+    return value;
+}
+
+static void json_string(Json* json, char* out, size_t size) {
+    json_expect(json, '"');
+    size_t length = 0;
+    while (json->p < json->end && *json->p != '"') {
+        if (*json->p == '\\')
+            json->p++;
+        if (length + 1 < size)
+            out[length++] = *json->p;
+        json->p++;
+    }
+    out[length] = '\0';
+    json_expect(json, '"');
+}
+
+static void json_skip(Json* json) {
+    char scratch[MAX_NAME];
+
+    if (json_peek(json, '"'))
+        json_string(json, scratch, sizeof(scratch));
+    else if (json_peek(json, '[') || json_peek(json, '{')) {
+        char close = *json->p == '[' ? ']' : '}';
+        json->p++;
+        if (json_peek(json, close)) {
+            json->p++;
+            return;
+        }
+        do {
+            if (close == '}') {
+                json_string(json, scratch, sizeof(scratch));
+                json_expect(json, ':');
+            }
+            json_skip(json);
+        } while (!json->error && json_next(json, close));
+    }
+    else
+        json_number(json);
+}
+
+static void parse_state(Json* json, StepState* state) {
+    char key[MAX_NAME];
+    memset(state, 0, sizeof(StepState));
+
+    json_expect(json, '{');
+    do {
+        json_string(json, key, sizeof(key));
+        json_expect(json, ':');
+
+        if (strcmp(key, "pc") == 0) state->pc = (uint16_t) json_number(json);
+        else if (strcmp(key, "s") == 0) state->s = (uint8_t) json_number(json);
+        else if (strcmp(key, "a") == 0) state->a = (uint8_t) json_number(json);
+        else if (strcmp(key, "x") == 0) state->x = (uint8_t) json_number(json);
+        else if (strcmp(key, "y") == 0) state->y = (uint8_t) json_number(json);
+        else if (strcmp(key, "p") == 0) state->p = (uint8_t) json_number(json);
+        else if (strcmp(key, "ram") == 0) {
+            json_expect(json, '[');
+            if (json_peek(json, ']'))
+                json->p++;
+            else do {
+                json_expect(json, '[');
+                uint16_t address = (uint16_t) json_number(json);
+                json_expect(json, ',');
+                uint8_t data = (uint8_t) json_number(json);
+                json_expect(json, ']');
+
+                if (state->ram_count == MAX_RAM_ENTRIES)
+                    json->error = true;
+                else {
+                    state->ram_address[state->ram_count] = address;
+                    state->ram_data[state->ram_count++] = data;
+                }
+            } while (!json->error && json_next(json, ']'));
+        }
+        else
+            json_skip(json);
+    } while (!json->error && json_next(json, '}'));
+}
+
+static size_t parse_cycles(Json* json) {
+    size_t count = 0;
+
+    json_expect(json, '[');
+    if (json_peek(json, ']')) {
+        json->p++;
+        return 0;
+    }
+    do {
+        json_skip(json);
+        count++;
+    } while (!json->error && json_next(json, ']'));
+    return count;
+}
+
+// Runs the instruction at the pc to its last cycle.
+static void step(Cpu* cpu) {
+    do
+        cpu_clock();
+    while (cpu->cycles != 0);
+}
+
+// Counts a failure and keeps the message of the first one.
+static void fail(Job* job, const char* message) {
+    if (job->failed++ == 0)
+        snprintf(job->failure, sizeof(job->failure), "%s", message);
+}
+
+static bool check(Job* job, const char* name, const char* what, unsigned expected, unsigned actual) {
+    if (expected == actual)
+        return true;
+
+    char message[MAX_FAILURE];
+    snprintf(message, sizeof(message), "%s: %s 0x%02x, expected 0x%02x", name, what, actual, expected);
+    fail(job, message);
+    return false;
+}
+
+static bool run_step(Job* job, Cpu* cpu, Bus* bus, const char* name, const StepState* initial, const StepState* final, size_t cycles) {
+    for (size_t i = 0; i < initial->ram_count; i++)
+        bus->ram[initial->ram_address[i]] = initial->ram_data[i];
+
+    cpu->pc = initial->pc;
+    cpu->sp = initial->s;
+    cpu->a = initial->a;
+    cpu->x = initial->x;
+    cpu->y = initial->y;
+    cpu->status = initial->p;
+    cpu->cycles = 0;
+    cpu->clock_count = 0;
+    cpu->halted = false;
+    step(cpu);
+
+    char what[MAX_NAME];
+    bool passed = check(job, name, "pc", final->pc, cpu->pc)
+        && check(job, name, "sp", final->s, cpu->sp)
+        && check(job, name, "a", final->a, cpu->a)
+        && check(job, name, "x", final->x, cpu->x)
+        && check(job, name, "y", final->y, cpu->y)
+        && check(job, name, "status", final->p & STATUS_MASK, cpu->status & STATUS_MASK)
+        && check(job, name, "cycles", (unsigned) cycles, (unsigned) cpu->clock_count);
+
+    for (size_t i = 0; passed && i < final->ram_count; i++) {
+        snprintf(what, sizeof(what), "ram[0x%04x]", final->ram_address[i]);
+        passed = check(job, name, what, final->ram_data[i], bus->ram[final->ram_address[i]]);
+    }
+    return passed;
+}
+
+static char* read_file(const char* path, size_t* size) {
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+
+    fseek(file, 0L, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0L, SEEK_SET);
+
+    char* data = malloc(length > 0 ? (size_t) length : 1);
+    *size = data ? fread(data, 1, (size_t) length, file) : 0;
+    fclose(file);
+    return data;
+}
+
+static void run_vectors(Job* job, Cpu* cpu, Bus* bus) {
+    size_t size;
+    char* data = read_file(job->path, &size);
+    if (!data)
+        return;
+    job->found = true;
+
+    Json json = { data, data + size, false };
+    char key[MAX_NAME];
+    char name[MAX_NAME];
+    StepState initial, final;
+
+    json_expect(&json, '[');
+    do {
+        size_t cycles = 0;
+        strcpy(name, "?");
+
+        json_expect(&json, '{');
+        do {
+            json_string(&json, key, sizeof(key));
+            json_expect(&json, ':');
+
+            if (strcmp(key, "name") == 0) json_string(&json, name, sizeof(name));
+            else if (strcmp(key, "initial") == 0) parse_state(&json, &initial);
+            else if (strcmp(key, "final") == 0) parse_state(&json, &final);
+            else if (strcmp(key, "cycles") == 0) cycles = parse_cycles(&json);
+            else json_skip(&json);
+        } while (!json.error && json_next(&json, '}'));
+
+        if (json.error)
+            break;
+        if (run_step(job, cpu, bus, name, &initial, &final, cycles))
+            job->passed++;
+    } while (json_next(&json, ']'));
+
+    if (json.error) {
+        char message[MAX_FAILURE];
+        snprintf(message, sizeof(message), "malformed near byte %ld", (long) (json.p - data));
+        fail(job, message);
+    }
+    free(data);
+}
+
+// Runs a whole program until it jumps to itself and returns where it stopped.
+static uint16_t run_program(Cpu* cpu) {
+    while (cpu->clock_count < PROGRAM_CYCLE_LIMIT && !cpu->halted) {
+        uint16_t start = cpu->pc;
+        step(cpu);
+        if (cpu->pc == start)
+            break;
+    }
+    return cpu->pc;
+}
+
+// Loads the binary at load in otherwise zeroed ram and points the cpu at start.
+static void run_image(Job* job, Cpu* cpu, Bus* bus, uint16_t load, uint16_t start) {
+    size_t size;
+    char* image = read_file(job->path, &size);
+    if (!image)
+        return;
+    job->found = true;
+
+    memset(bus->ram, 0, RAM_SIZE);
+    memcpy(bus->ram + load, image, size < RAM_SIZE - load ? size : RAM_SIZE - load);
+    free(image);
+
+    cpu->pc = start;
+    cpu->sp = 0xFF;
+    cpu->a = cpu->x = cpu->y = 0;
+    cpu->status = U;
+    cpu->cycles = 0;
+    cpu->clock_count = 0;
+    cpu->halted = false;
+}
+
+static void run_functional(Job* job, Cpu* cpu, Bus* bus, uint16_t success) {
+    run_image(job, cpu, bus, FUNCTIONAL_LOAD, FUNCTIONAL_START);
+    if (!job->found)
+        return;
+
+    uint16_t trap = run_program(cpu);
+    if (trap == success)
+        job->passed++;
+    else {
+        char message[MAX_FAILURE];
+        snprintf(message, sizeof(message), "trapped at 0x%04x after %llu cycles", trap, (unsigned long long) cpu->clock_count);
+        fail(job, message);
+    }
+}
+
+static void run_decimal(Job* job, Cpu* cpu, Bus* bus) {
+    run_image(job, cpu, bus, DECIMAL_START, DECIMAL_START);
+    if (!job->found)
+        return;
+
+    uint16_t trap = run_program(cpu);
+    if (bus->ram[DECIMAL_ERROR] == 0 && cpu->clock_count < PROGRAM_CYCLE_LIMIT)
+        job->passed++;
+    else {
+        char message[MAX_FAILURE];
+        snprintf(message, sizeof(message), "ERROR 0x%02x, trapped at 0x%04x", bus->ram[DECIMAL_ERROR], trap);
+        fail(job, message);
+    }
+}
+
+static void* worker(void* argument) {
+    Suite* suite = argument;
+    Bus bus;
+
+    if (!bus_init(&bus) || !cpu_init())
+        exit(EXIT_FAILURE);
+    cpu_connect_bus(&bus);
+    Cpu* cpu = get_cpu();
+
+    size_t index;
+    while ((index = atomic_fetch_add(&suite->next_job, 1)) < suite->job_count) {
+        Job* job = &suite->jobs[index];
+        switch (job->kind) {
+        case JOB_VECTORS: run_vectors(job, cpu, &bus); break;
+        case JOB_FUNCTIONAL: run_functional(job, cpu, &bus, suite->functional_success); break;
+        case JOB_DECIMAL: run_decimal(job, cpu, &bus); break;
+        }
+    }
+
+    cpu_free();
+    bus_free(&bus);
+    return NULL;
+}
+
+static void run_suite(Suite* suite, long jobs) {
+#ifndef _WIN32
+    pthread_t threads[MAX_JOBS];
+    if (jobs > MAX_JOBS)
+        jobs = MAX_JOBS;
+
+    for (long i = 0; i < jobs; i++) {
+        if (pthread_create(&threads[i], NULL, &worker, suite) != 0) {
+            fprintf(stderr, "Unable to start worker %ld.\n", i);
+            exit(EXIT_FAILURE);
+        }
+    }
+    for (long i = 0; i < jobs; i++)
+        pthread_join(threads[i], NULL);
+#else
+    worker(suite);
+#endif
+}
+
+// One cell per opcode: ok, FAIL, ILL when the core does not implement it, and -- without vectors.
+static void print_matrix(const Suite* suite) {
+    const Job* vectors[OPCODES] = { NULL };
+    for (size_t i = 0; i < suite->job_count; i++)
+        if (suite->jobs[i].kind == JOB_VECTORS)
+            vectors[suite->jobs[i].opcode] = &suite->jobs[i];
+
+    printf("    ");
+    for (int column = 0; column < 0x10; column++)
+        printf("    %X", column);
+    printf("\n");
+
+    for (int row = 0; row < 0x10; row++) {
+        printf("  %X ", row);
+        for (int column = 0; column < 0x10; column++) {
+            const Job* job = vectors[(row << 4) | column];
+            const char* cell = "--";
+            if (instructions[(row << 4) | column].opcode == &ILL)
+                cell = "ILL";
+            else if (job && job->found)
+                cell = job->failed ? "FAIL" : "ok";
+            printf(" %4s", cell);
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char* argv[]) {
+    static Suite suite;
+    const char* functional_path = NULL;
+    const char* decimal_path = NULL;
+    bool quiet = false;
+    long jobs = 0;
+    int option;
+
+    suite.functional_success = FUNCTIONAL_SUCCESS;
+    while ((option = getopt(argc, argv, "f:s:d:j:q")) != -1) {
+        switch (option) {
+        case 'f': functional_path = optarg; break;
+        case 's': suite.functional_success = (uint16_t) strtol(optarg, NULL, 0); break;
+        case 'd': decimal_path = optarg; break;
+        case 'j': jobs = strtol(optarg, NULL, 0); break;
+        case 'q': quiet = true; break;
+        default: usage();
+        }
+    }
+    if (optind + 1 < argc)
+        usage();
+
+#ifndef _WIN32
+    if (jobs <= 0)
+        jobs = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (jobs <= 0)
+        jobs = 1;
+
+    // The long whole program tests go first so they overlap with the vectors.
+    if (functional_path) {
+        Job* job = &suite.jobs[suite.job_count++];
+        job->kind = JOB_FUNCTIONAL;
+        snprintf(job->path, sizeof(job->path), "%s", functional_path);
+    }
+    if (decimal_path) {
+        Job* job = &suite.jobs[suite.job_count++];
+        job->kind = JOB_DECIMAL;
+        snprintf(job->path, sizeof(job->path), "%s", decimal_path);
+    }
+
+    // Opcodes the core does not implement have nothing to check, their vectors are left out.
+    if (optind < argc) {
+        for (int opcode = 0; opcode < OPCODES; opcode++) {
+            if (instructions[opcode].opcode == &ILL)
+                continue;
+            Job* job = &suite.jobs[suite.job_count++];
+            job->kind = JOB_VECTORS;
+            job->opcode = (uint8_t) opcode;
+            snprintf(job->path, sizeof(job->path), "%s/%02x.json", argv[optind], opcode);
+        }
+    }
+    atomic_init(&suite.next_job, 0);
+    if ((size_t) jobs > suite.job_count)
+        jobs = suite.job_count > 0 ? (long) suite.job_count : 1;
+
+    uint64_t start = stats_now_ns();
+    run_suite(&suite, jobs);
+    uint64_t elapsed = stats_now_ns() - start;
+
+    uint64_t passed = 0, failed = 0;
+    size_t found = 0, failing = 0;
+    for (size_t i = 0; i < suite.job_count; i++) {
+        const Job* job = &suite.jobs[i];
+        passed += job->passed;
+        failed += job->failed;
+        found += job->found;
+        failing += job->failed > 0;
+    }
+
+    for (size_t i = 0; i < suite.job_count; i++) {
+        const Job* job = &suite.jobs[i];
+        if (job->kind != JOB_VECTORS && !job->found)
+            printf("%s: not found, skipped.\n", job->path);
+        else if (job->kind != JOB_VECTORS)
+            printf("%s: %s.\n", job->path, job->failed ? job->failure : "passed");
+    }
+
+    size_t vector_files = 0;
+    for (size_t i = 0; i < suite.job_count; i++)
+        vector_files += suite.jobs[i].kind == JOB_VECTORS && suite.jobs[i].found;
+
+    if (optind < argc && vector_files == 0)
+        printf("%s: no vectors found, skipped.\n", argv[optind]);
+    else if (optind < argc && (!quiet || failing > 0)) {
+        print_matrix(&suite);
+        for (size_t i = 0; i < suite.job_count; i++) {
+            const Job* job = &suite.jobs[i];
+            if (job->kind == JOB_VECTORS && job->failed)
+                printf("  %02x %s: %llu of %llu failed, first %s\n", job->opcode, instructions[job->opcode].name,
+                    (unsigned long long) job->failed, (unsigned long long) (job->passed + job->failed), job->failure);
+        }
+    }
+
+    if (found == 0)
+        printf("No conformance tests found, nothing was checked. Run make test-fetch for the suites.\n");
+    printf("%llu passed, %llu failed in %zu files on %ld threads, %.2f s.\n", (unsigned long long) passed,
+        (unsigned long long) failed, found, jobs, (double) elapsed / 1e9);
+
+    return failing > 0 || found == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
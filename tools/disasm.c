@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include "../include/disasm.h"
+#include "../include/rom.h"
+
+#define MAX_ENTRIES 64
+#define HEX_ORIGIN 0x8000
+#define NMI_VECTOR 0xFFFA
+#define RESET_VECTOR 0xFFFC
+#define IRQ_VECTOR 0xFFFE
+
+static uint8_t memory[DISASM_MEMORY_SIZE];
+
+static void usage() {
+    fprintf(stderr,
+        "usage: disasm6502 [options] file\n"
+        "  -x              file is a hex text rom like program.txt (the default for .txt files)\n"
+        "  -o address      load address (default 0x8000 for hex text, top of memory for binaries)\n"
+        "  -e address      entry point, may be repeated (default the vectors, or the load address)\n"
+        "  -r start:end    only list this range\n"
+        "  -l              linear sweep without control flow analysis\n"
+        "  -c              print the call graph in dot format instead of the listing\n"
+        "  -t              print how long the analysis took\n");
+    exit(EXIT_FAILURE);
+}
+
+static bool vector_in_image(uint16_t vector, uint32_t origin, uint32_t end) {
+    return vector >= origin && vector + 1 < end;
+}
+
+int main(int argc, char* argv[]) {
+    bool hex = false, linear = false, call_graph = false, timing = false;
+    long origin = -1;
+    uint16_t entries[MAX_ENTRIES];
+    size_t entry_count = 0;
+    long range_start = -1, range_end = -1;
+    int option;
+
+    while ((option = getopt(argc, argv, "xo:e:r:lct")) != -1) {
+        switch (option) {
+        case 'x': hex = true; break;
+        case 'o': origin = strtol(optarg, NULL, 0); break;
+        case 'e':
+            if (entry_count < MAX_ENTRIES)
+                entries[entry_count++] = (uint16_t) strtol(optarg, NULL, 0);
+            break;
+        case 'r': {
+            char* separator = strchr(optarg, ':');
+            if (!separator)
+                usage();
+            range_start = strtol(optarg, NULL, 0);
+            range_end = strtol(separator + 1, NULL, 0);
+            if (range_start < 0)
+                usage();
+            break;
+        }
+        case 'l': linear = true; break;
+        case 'c': call_graph = true; break;
+        case 't': timing = true; break;
+        default: usage();
+        }
+    }
+    if (optind >= argc)
+        usage();
+    hex = hex || rom_is_hex(argv[optind]);
+
+    uint8_t* image = malloc(DISASM_MEMORY_SIZE);
+    long size = rom_read(argv[optind], hex, image, DISASM_MEMORY_SIZE);
+    if (size < 0)
+        exit(EXIT_FAILURE);
+
+    if (origin < 0)
+        origin = hex ? HEX_ORIGIN : DISASM_MEMORY_SIZE - size;
+    if (origin + size > DISASM_MEMORY_SIZE) {
+        fprintf(stderr, "Image of %ld bytes does not fit at 0x%04lx.\n", size, origin);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(memory + origin, image, size);
+    free(image);
+
+    uint32_t end = origin + size;
+    if (range_start < 0) {
+        range_start = origin;
+        range_end = end;
+    }
+    if (range_end > DISASM_MEMORY_SIZE)
+        range_end = DISASM_MEMORY_SIZE;
+    if (range_start > range_end) {
+        fprintf(stderr, "Range 0x%04lx:0x%04lx starts after it ends.\n", range_start, range_end);
+        exit(EXIT_FAILURE);
+    }
+
+    if (linear) {
+        disasm_print_linear(memory, range_start, range_end, stdout);
+        return 0;
+    }
+
+    if (entry_count == 0) {
+        uint16_t vectors[] = { RESET_VECTOR, NMI_VECTOR, IRQ_VECTOR };
+        for (int i = 0; i < 3; i++) {
+            if (!vector_in_image(vectors[i], origin, end))
+                continue;
+            uint16_t entry = (memory[vectors[i] + 1] << 8) | memory[vectors[i]];
+            if (entry >= origin && entry < end)
+                entries[entry_count++] = entry;
+        }
+        if (entry_count == 0)
+            entries[entry_count++] = origin;
+    }
+
+    clock_t start = clock();
+    DisasmAnalysis* analysis = disasm_analyze(memory, entries, entry_count);
+    clock_t stop = clock();
+
+    if (call_graph)
+        disasm_print_call_graph(analysis, stdout);
+    else
+        disasm_print_listing(analysis, range_start, range_end, stdout);
+
+    if (timing) {
+        fprintf(stderr, "Analyzed %zu blocks and %zu calls in %.3f ms.\n", analysis->block_count, analysis->call_count,
+            (stop - start) * 1000.0 / CLOCKS_PER_SEC);
+    }
+
+    disasm_free(analysis);
+    return 0;
+}
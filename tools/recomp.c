@@ -0,0 +1,297 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include "../include/cpu.h"
+#include "../include/disasm.h"
+#include "../include/rom.h"
+
+#define MAX_ENTRIES 64
+#define HEX_ORIGIN 0x8000
+#define NMI_VECTOR 0xFFFA
+#define RESET_VECTOR 0xFFFC
+#define IRQ_VECTOR 0xFFFE
+
+typedef struct {
+    Opcode opcode;
+    const char* name;
+} Handler;
+
+#define HANDLER(name) { &name, #name }
+
+static const Handler handlers[] = {
+    HANDLER(ILL), HANDLER(NOP),
+    HANDLER(LDA), HANDLER(LDX), HANDLER(LDY), HANDLER(STA), HANDLER(STX), HANDLER(STY),
+    HANDLER(TAX), HANDLER(TAY), HANDLER(TSX), HANDLER(TXA), HANDLER(TXS), HANDLER(TYA),
+    HANDLER(ORA), HANDLER(AND), HANDLER(EOR),
+    HANDLER(PHA), HANDLER(PHP), HANDLER(PLA), HANDLER(PLP),
+    HANDLER(ROL), HANDLER(ROR), HANDLER(ASL), HANDLER(LSR),
+    HANDLER(RTI), HANDLER(RTS), HANDLER(JSR),
+    HANDLER(CLC), HANDLER(CLD), HANDLER(CLI), HANDLER(CLV), HANDLER(SEC), HANDLER(SED), HANDLER(SEI),
+    HANDLER(DEC), HANDLER(DEX), HANDLER(DEY), HANDLER(INC), HANDLER(INX), HANDLER(INY),
+    HANDLER(ADC), HANDLER(SBC), HANDLER(CMP), HANDLER(CPX), HANDLER(CPY),
+    HANDLER(BIT), HANDLER(JMP),
+    HANDLER(BCC), HANDLER(BCS), HANDLER(BEQ), HANDLER(BMI), HANDLER(BNE), HANDLER(BPL), HANDLER(BVS), HANDLER(BVC),
+    HANDLER(BRK), HANDLER(BRA),
+    HANDLER(PHX), HANDLER(PHY), HANDLER(PLX), HANDLER(PLY),
+    HANDLER(STZ), HANDLER(TRB), HANDLER(TSB),
+    HANDLER(LAX), HANDLER(SAX), HANDLER(SLO), HANDLER(RLA), HANDLER(SRE), HANDLER(RRA), HANDLER(DCP), HANDLER(ISC),
+    HANDLER(ANC), HANDLER(ALR), HANDLER(ARR), HANDLER(SBX), HANDLER(LAS), HANDLER(JAM),
+};
+
+static const char* mode_names[] = {
+    [ADDR_IMP] = "MODE_IMP", [ADDR_ACC] = "MODE_ACC", [ADDR_IMM] = "MODE_IMM",
+    [ADDR_ABS] = "MODE_ABS", [ADDR_ZP] = "MODE_ZP",   [ADDR_REL] = "MODE_REL",
+    [ADDR_IND] = "MODE_IND", [ADDR_ABX] = "MODE_ABX", [ADDR_ABY] = "MODE_ABY",
+    [ADDR_ZPX] = "MODE_ZPX", [ADDR_ZPY] = "MODE_ZPY",
+    [ADDR_INX] = "MODE_INX", [ADDR_INY] = "MODE_INY",
+    [ADDR_ZPI] = "MODE_ZPI", [ADDR_IAX] = "MODE_IAX",
+};
+
+static uint8_t memory[DISASM_MEMORY_SIZE];
+
+static void usage() {
+    fprintf(stderr,
+        "usage: recomp6502 [options] file\n"
+        "  -x              file is a hex text rom like program.txt (the default for .txt files)\n"
+        "  -o address      load address (default 0x8000 for hex text, top of memory for binaries)\n"
+        "  -e address      entry point, may be repeated (default the vectors, or the load address)\n"
+        "  -O file         write the C source here instead of stdout\n");
+    exit(EXIT_FAILURE);
+}
+
+static const char* handler_name(uint8_t opcode) {
+    for (size_t i = 0; i < sizeof(handlers) / sizeof(handlers[0]); i++) {
+        if (handlers[i].opcode == instructions[opcode].opcode)
+            return handlers[i].name;
+    }
+    return NULL;
+}
+
+// Undocumented opcodes go through the policy of the cpu running the generated code.
+static void emit_handler(FILE* out, uint8_t opcode) {
+    const char* name = handler_name(opcode);
+    if (cpu_undocumented(opcode))
+        fprintf(out, "cpu_run_undocumented();");
+    else if (name)
+        fprintf(out, "%s();", name);
+    else
+        fprintf(out, "instructions[0x%02X].opcode();", opcode);
+}
+
+// Emits the address mode with the operand folded in where it does not depend on memory. The modes
+// that read pointers, and relative branches, run the real handler with the pc on the operand.
+static void emit_address_mode(FILE* out, const DisasmInstruction* instruction) {
+    uint16_t operand = instruction->operand;
+
+    switch (instruction->mode) {
+    case ADDR_IMP: break;
+    case ADDR_ACC: fprintf(out, "cpu->fetched_data = cpu->a; "); break;
+    case ADDR_IMM: fprintf(out, "cpu->fetched_data = 0x%02X; ", operand); break;
+    case ADDR_ZP:
+    case ADDR_ABS: fprintf(out, "cpu->fetched_address = 0x%04X; ", operand); break;
+    case ADDR_ZPX: fprintf(out, "cpu->fetched_address = (0x%02X + cpu->x) & 0x00FF; ", operand); break;
+    case ADDR_ZPY: fprintf(out, "cpu->fetched_address = (0x%02X + cpu->y) & 0x00FF; ", operand); break;
+    case ADDR_ABX: fprintf(out, "cpu->fetched_address = 0x%04X + cpu->x; ", operand); break;
+    case ADDR_ABY: fprintf(out, "cpu->fetched_address = 0x%04X + cpu->y; ", operand); break;
+    default:
+        fprintf(out, "cpu->pc = 0x%04X; %s(); ", (uint16_t)(instruction->address + 1), mode_names[instruction->mode]);
+        break;
+    }
+}
+
+static bool uses_mode_handler(AddressModeKind mode) {
+    return mode == ADDR_REL || mode == ADDR_IND || mode == ADDR_INX || mode == ADDR_INY || mode == ADDR_ZPI || mode == ADDR_IAX;
+}
+
+static const Opcode stores[] = {
+    &STA, &STX, &STY, &STZ, &INC, &DEC, &ASL, &LSR, &ROL, &ROR, &TRB, &TSB,
+    &SAX, &SLO, &RLA, &SRE, &RRA, &DCP, &ISC,
+};
+
+static bool writes_memory(const DisasmInstruction* instruction) {
+    if (instruction->mode == ADDR_IMP || instruction->mode == ADDR_ACC || instruction->mode == ADDR_IMM)
+        return false;
+    for (size_t i = 0; i < sizeof(stores) / sizeof(stores[0]); i++) {
+        if (stores[i] == instructions[instruction->opcode].opcode)
+            return true;
+    }
+    return false;
+}
+
+static void emit_counters(FILE* out, const char* indent, uint32_t cycles, uint32_t instruction_count) {
+    // Handlers add the cycles they take on top of the table, like decimal mode on the 65C02, to cpu->cycles.
+    fprintf(out, "%scpu->clock_count += %u + cpu->cycles;\n", indent, cycles);
+    fprintf(out, "%scpu->cycles = 0;\n", indent);
+    fprintf(out, "%scpu->instruction_count += %u;\n", indent, instruction_count);
+}
+
+// A store into the rest of the block leaves it, so the dispatcher checks the bytes again before
+// running translated code. Absolute and zero page stores are decided here, the others at run time.
+static void emit_store_check(FILE* out, const DisasmInstruction* instruction, uint32_t next, uint32_t end,
+    uint32_t cycles, uint32_t instruction_count) {
+    if (next >= end || !writes_memory(instruction))
+        return;
+    if ((instruction->mode == ADDR_ABS || instruction->mode == ADDR_ZP) && (instruction->operand < next || instruction->operand >= end))
+        return;
+
+    fprintf(out, "    if ((uint16_t)(cpu->fetched_address - 0x%04X) < %u) {\n", next, end - next);
+    fprintf(out, "        cpu->pc = 0x%04X;\n", next);
+    emit_counters(out, "        ", cycles, instruction_count);
+    fprintf(out, "        return;\n");
+    fprintf(out, "    }\n");
+}
+
+static void emit_block(FILE* out, const DisasmAnalysis* analysis, const DisasmBlock* block) {
+    DisasmInstruction instruction;
+    char text[32];
+    uint32_t cycles = 0;
+    uint32_t instruction_count = 0;
+
+    fprintf(out, "// $%04X - $%04X\n", block->start, block->last);
+    fprintf(out, "static void block_%04X(Cpu* cpu) {\n", block->start);
+
+    for (uint32_t address = block->start; address <= block->last; address += instruction.length) {
+        disasm_decode(memory, address, &instruction);
+        disasm_format(&instruction, text, sizeof(text));
+        cycles += instructions[instruction.opcode].cycles;
+
+        fprintf(out, "    cpu->opcode = 0x%02X; ", instruction.opcode);
+        emit_address_mode(out, &instruction);
+        // Jumps, calls and branches read the pc, so it has to be past the instruction before they run.
+        // So do undocumented opcodes, which report and trap at the address before it.
+        bool undocumented = cpu_undocumented(instruction.opcode);
+        if ((instruction.flow != FLOW_NONE || undocumented) && !uses_mode_handler(instruction.mode))
+            fprintf(out, "cpu->pc = 0x%04X; ", (uint16_t)(address + instruction.length));
+        emit_handler(out, instruction.opcode);
+        fprintf(out, " // %s\n", text);
+        // JAM and trapped opcodes halt the cpu, the rest of the block must not run.
+        if (undocumented) {
+            fprintf(out, "    if (cpu->halted) {\n");
+            emit_counters(out, "        ", cycles, instruction_count + 1);
+            fprintf(out, "        return;\n");
+            fprintf(out, "    }\n");
+        }
+        emit_store_check(out, &instruction, address + instruction.length, block->end, cycles, ++instruction_count);
+    }
+
+    if (block->exit == FLOW_NONE)
+        fprintf(out, "    cpu->pc = 0x%04X;\n", (uint16_t) block->end);
+    emit_counters(out, "    ", cycles, block->instruction_count);
+    fprintf(out, "}\n\n");
+}
+
+static void emit_program(FILE* out, const char* name, const DisasmAnalysis* analysis, uint16_t origin, uint32_t size,
+    uint32_t program_end) {
+    fprintf(out, "// Generated by recomp6502 from %s, do not edit.\n", name);
+    fprintf(out, "#include \"recomp.h\"\n\n");
+
+    fprintf(out, "static const uint8_t image[] = {");
+    for (uint32_t i = 0; i < size; i++)
+        fprintf(out, "%s0x%02X,", (i % 16 == 0) ? "\n    " : " ", memory[origin + i]);
+    fprintf(out, "\n};\n\n");
+
+    // Only blocks that lie completely inside the image are translated, anything else stays interpreted.
+    for (size_t i = 0; i < analysis->block_count; i++) {
+        const DisasmBlock* block = &analysis->blocks[i];
+        if (block->start >= origin && block->end <= origin + size)
+            emit_block(out, analysis, block);
+    }
+
+    fprintf(out, "static const RecompBlock blocks[] = {\n");
+    for (size_t i = 0; i < analysis->block_count; i++) {
+        const DisasmBlock* block = &analysis->blocks[i];
+        if (block->start >= origin && block->end <= origin + size)
+            fprintf(out, "    { 0x%04X, %u, &block_%04X },\n", block->start, block->end - block->start, block->start);
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const RecompBlock* const block_table[%u] = {\n", size);
+    size_t index = 0;
+    for (size_t i = 0; i < analysis->block_count; i++) {
+        const DisasmBlock* block = &analysis->blocks[i];
+        if (block->start >= origin && block->end <= origin + size)
+            fprintf(out, "    [0x%04X] = &blocks[%zu],\n", block->start - origin, index++);
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const RecompProgram program = {\n");
+    fprintf(out, "    \"%s\", image, 0x%04X, %u, 0x%05X, block_table,\n", name, origin, size, program_end);
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "int main(void) {\n");
+    fprintf(out, "    return recomp_main(&program);\n");
+    fprintf(out, "}\n");
+}
+
+int main(int argc, char* argv[]) {
+    bool hex = false;
+    long origin = -1;
+    uint16_t entries[MAX_ENTRIES];
+    size_t entry_count = 0;
+    const char* output = NULL;
+    int option;
+
+    while ((option = getopt(argc, argv, "xo:e:O:")) != -1) {
+        switch (option) {
+        case 'x': hex = true; break;
+        case 'o': origin = strtol(optarg, NULL, 0); break;
+        case 'e':
+            if (entry_count < MAX_ENTRIES)
+                entries[entry_count++] = (uint16_t) strtol(optarg, NULL, 0);
+            break;
+        case 'O': output = optarg; break;
+        default: usage();
+        }
+    }
+    if (optind >= argc)
+        usage();
+    hex = hex || rom_is_hex(argv[optind]);
+
+    uint8_t* image = malloc(DISASM_MEMORY_SIZE);
+    long size = rom_read(argv[optind], hex, image, DISASM_MEMORY_SIZE);
+    if (size <= 0)
+        exit(EXIT_FAILURE);
+
+    if (origin < 0)
+        origin = hex ? HEX_ORIGIN : DISASM_MEMORY_SIZE - size;
+    if (origin + size > DISASM_MEMORY_SIZE) {
+        fprintf(stderr, "Image of %ld bytes does not fit at 0x%04lx.\n", size, origin);
+        exit(EXIT_FAILURE);
+    }
+    memcpy(memory + origin, image, size);
+    free(image);
+
+    // The emulator stops when the pc passes the last byte of a hex text rom, binaries run on.
+    uint32_t program_end = hex ? origin + size : DISASM_MEMORY_SIZE;
+
+    uint32_t end = origin + size;
+    if (entry_count == 0) {
+        uint16_t vectors[] = { RESET_VECTOR, NMI_VECTOR, IRQ_VECTOR };
+        for (int i = 0; i < 3; i++) {
+            if (vectors[i] < origin || vectors[i] + 1 >= end)
+                continue;
+            uint16_t entry = (memory[vectors[i] + 1] << 8) | memory[vectors[i]];
+            if (entry >= origin && entry < end)
+                entries[entry_count++] = entry;
+        }
+        if (entry_count == 0)
+            entries[entry_count++] = origin;
+    }
+
+    DisasmAnalysis* analysis = disasm_analyze(memory, entries, entry_count);
+
+    FILE* out = output ? fopen(output, "w") : stdout;
+    if (!out) {
+        fprintf(stderr, "Unable to open '%s' for writing.\n", output);
+        exit(EXIT_FAILURE);
+    }
+
+    const char* name = strrchr(argv[optind], '/');
+    emit_program(out, name ? name + 1 : argv[optind], analysis, origin, size, program_end);
+
+    if (output)
+        fclose(out);
+    disasm_free(analysis);
+    return 0;
+}
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <getopt.h>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include "../include/stats.h"
+
+#define MAX_INSTANCES 1024
+
+typedef struct {
+    const char* name;
+    const char* type;
+    const char* help;
+    size_t offset;
+} Metric;
+
+#define COUNTER(name, field, help) { name, "counter", help, offsetof(StatsCounters, field) }
+
+static const Metric metrics[] = {
+    COUNTER("emu6502_instructions_total", instructions, "Instructions retired."),
+    COUNTER("emu6502_cycles_total", cycles, "Emulated clock cycles."),
+    COUNTER("emu6502_bus_reads_total", bus_reads, "Reads from the bus."),
+    COUNTER("emu6502_bus_writes_total", bus_writes, "Writes to the bus."),
+    COUNTER("emu6502_mmio_callbacks_total", mmio_callbacks, "Reads and writes handled by memory mapped devices."),
+    COUNTER("emu6502_interrupts_total", interrupts, "IRQs and NMIs taken."),
+    COUNTER("emu6502_illegal_opcodes_total", illegal, "Illegal opcodes executed."),
+};
+
+static void usage() {
+    fprintf(stderr,
+        "usage: stat6502 [options]\n"
+        "  -a              only print the totals across all instances\n"
+        "  -o file         write to this file, replacing it atomically, instead of stdout\n"
+        "  -i seconds      keep sampling at this interval instead of exiting\n"
+        "Instances publish into $" STATS_DIR_ENV " (default " STATS_DEFAULT_DIR ") when run with -s.\n");
+    exit(EXIT_FAILURE);
+}
+
+static bool process_alive(int32_t pid) {
+    return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+static size_t collect(StatsBlock* samples, size_t capacity) {
+    const char* dir_name = stats_directory();
+    DIR* dir = opendir(dir_name);
+    if (!dir) {
+        fprintf(stderr, "Unable to open stats directory '%s'.\n", dir_name);
+        return 0;
+    }
+
+    size_t count = 0;
+    struct dirent* entry;
+    char path[512];
+
+    while ((entry = readdir(dir)) && count < capacity) {
+        if (strncmp(entry->d_name, STATS_FILE_PREFIX, strlen(STATS_FILE_PREFIX)) != 0)
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", dir_name, entry->d_name);
+        // Instances that crashed leave their file behind, those are skipped.
+        if (stats_read(path, &samples[count]) && process_alive(samples[count].pid))
+            count++;
+    }
+
+    closedir(dir);
+    return count;
+}
+
+static uint64_t counter_value(const StatsBlock* sample, const Metric* metric) {
+    return *(const uint64_t*)((const uint8_t*) &sample->counters + metric->offset);
+}
+
+static void print_name_label(FILE* out, const char* name) {
+    for (; *name; name++) {
+        if (*name == '"' || *name == '\\')
+            fputc('\\', out);
+        fputc(*name, out);
+    }
+}
+
+static void print_metrics(FILE* out, const StatsBlock* samples, size_t count, bool totals_only) {
+    for (size_t m = 0; m < sizeof(metrics) / sizeof(metrics[0]); m++) {
+        const Metric* metric = &metrics[m];
+        uint64_t total = 0;
+
+        fprintf(out, "# HELP %s %s\n# TYPE %s %s\n", metric->name, metric->help, metric->name, metric->type);
+        for (size_t i = 0; i < count; i++) {
+            uint64_t value = counter_value(&samples[i], metric);
+            total += value;
+
+            if (!totals_only) {
+                fprintf(out, "%s{pid=\"%d\",rom=\"", metric->name, samples[i].pid);
+                print_name_label(out, samples[i].name);
+                fprintf(out, "\"} %llu\n", (unsigned long long) value);
+            }
+        }
+        fprintf(out, "%s{pid=\"all\"} %llu\n", metric->name, (unsigned long long) total);
+    }
+
+    double total_mhz = 0.0;
+    fprintf(out, "# HELP emu6502_emulated_mhz Emulated clock rate over the last publish interval.\n");
+    fprintf(out, "# TYPE emu6502_emulated_mhz gauge\n");
+    for (size_t i = 0; i < count; i++) {
+        double mhz = (double) samples[i].hz / 1000000.0;
+        total_mhz += mhz;
+
+        if (!totals_only) {
+            fprintf(out, "emu6502_emulated_mhz{pid=\"%d\",rom=\"", samples[i].pid);
+            print_name_label(out, samples[i].name);
+            fprintf(out, "\"} %.3f\n", mhz);
+        }
+    }
+    fprintf(out, "emu6502_emulated_mhz{pid=\"all\"} %.3f\n", total_mhz);
+
+    fprintf(out, "# HELP emu6502_instances Running emulator instances publishing stats.\n");
+    fprintf(out, "# TYPE emu6502_instances gauge\n");
+    fprintf(out, "emu6502_instances %zu\n", count);
+}
+
+static void write_metrics(const char* output, const StatsBlock* samples, size_t count, bool totals_only) {
+    if (!output) {
+        print_metrics(stdout, samples, count, totals_only);
+        fflush(stdout);
+        return;
+    }
+
+    // Scrapers never see a half written file, it is written aside and renamed over the old one.
+    char temp[512];
+    snprintf(temp, sizeof(temp), "%s.tmp", output);
+    FILE* out = fopen(temp, "w");
+    if (!out) {
+        fprintf(stderr, "Unable to open '%s' for writing.\n", temp);
+        return;
+    }
+    print_metrics(out, samples, count, totals_only);
+    fclose(out);
+    rename(temp, output);
+}
+
+int main(int argc, char* argv[]) {
+    bool totals_only = false;
+    const char* output = NULL;
+    unsigned interval = 0;
+    int option;
+
+    while ((option = getopt(argc, argv, "ao:i:")) != -1) {
+        switch (option) {
+        case 'a': totals_only = true; break;
+        case 'o': output = optarg; break;
+        case 'i': interval = (unsigned) strtoul(optarg, NULL, 0); break;
+        default: usage();
+        }
+    }
+
+    StatsBlock* samples = malloc(sizeof(StatsBlock) * MAX_INSTANCES);
+
+    do {
+        size_t count = collect(samples, MAX_INSTANCES);
+        write_metrics(output, samples, count, totals_only);
+
+        if (interval)
+            sleep(interval);
+    } while (interval);
+
+    free(samples);
+    return 0;
+}